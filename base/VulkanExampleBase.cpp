@@ -16,6 +16,7 @@
 
 #include <chrono>
 #include <thread>
+#include <algorithm>
 
 // #define _VALIDATION
 
@@ -667,9 +668,15 @@ VulkanExampleBase::VulkanExampleBase()
 	  }
 	  if ((args[i] == std::string("-p")) || (args[i] == std::string("--path"))) {
 	    settings.followPath = true;
-	    std::string pathFile = args[i + 1];
-	    std::cout << "pathFile: " << pathFile << std::endl;
-	    settings.pathViews = getPathDecomposed(pathFile);
+	    settings.pathFile = args[i + 1];
+	    std::cout << "pathFile: " << settings.pathFile << std::endl;
+	  }
+	  if(args[i] == std::string("--path-fps")) {
+	    settings.path_fps = std::stof(args[++i]);
+	    if(settings.path_fps <= 0.0f) {
+	      std::cerr << "Path frame rate must be positive, exiting" << std::endl;
+	      exit(-1);
+	    }
 	  }
 	  if ((args[i] == std::string("-s")) || (args[i] == std::string("--scene"))) {
 	    settings.sceneFile = args[++i];
@@ -699,6 +706,75 @@ VulkanExampleBase::VulkanExampleBase()
 	    settings.interval_t0 = std::stoi(args[++i]);
 	    settings.interval_t1 = std::stoi(args[++i]);
 	  }
+	  if(args[i] == std::string("--preview")) {
+	    settings.preview_format = args[++i];
+	    if(settings.preview_format == "jpeg") {
+	      settings.preview_format = "jpg";
+	    }
+	    if(settings.preview_format != "png" && settings.preview_format != "jpg") {
+	      std::cerr << "Preview format " << settings.preview_format << " is not recognized (use png or jpg), exiting" << std::endl;
+	      exit(-1);
+	    }
+	  }
+	  if(args[i] == std::string("--preview-mode")) {
+	    settings.preview_mode = args[++i];
+	    if(settings.preview_mode != "auto" && settings.preview_mode != "tonemap" && settings.preview_mode != "normalize" &&
+	       settings.preview_mode != "clamp" && settings.preview_mode != "signed") {
+	      std::cerr << "Preview mode " << settings.preview_mode << " is not recognized, exiting" << std::endl;
+	      exit(-1);
+	    }
+	  }
+	  if(args[i] == std::string("--preview-downscale")) {
+	    settings.preview_downscale = std::max(1, std::stoi(args[++i]));
+	  }
+	  if(args[i] == std::string("--preview-quality")) {
+	    settings.preview_quality = std::min(100, std::max(1, std::stoi(args[++i])));
+	  }
+	  if(args[i] == std::string("--writer-threads")) {
+	    settings.writer_threads = std::max(0, std::stoi(args[++i]));
+	  }
+	  if(args[i] == std::string("--update-threads")) {
+	    settings.update_threads = std::max(0, std::stoi(args[++i]));
+	  }
+	  if(args[i] == std::string("--compute-skinning")) {
+	    settings.compute_skinning = true;
+	  }
+	  if(args[i] == std::string("--indirect-draw")) {
+	    settings.indirect_draw = true;
+	  }
+	  if(args[i] == std::string("--bindless")) {
+	    settings.bindless = true;
+	    settings.indirect_draw = true;
+	  }
+	  if(args[i] == std::string("--cpu-culling")) {
+	    settings.cpu_culling = true;
+	  }
+	  if(args[i] == std::string("--gpu-culling")) {
+	    settings.gpu_culling = true;
+	    settings.indirect_draw = true;
+	  }
+	  if(args[i] == std::string("--occlusion-culling")) {
+	    settings.occlusion_culling = true;
+	    settings.gpu_culling = true;
+	    settings.indirect_draw = true;
+	  }
+	  if(args[i] == std::string("--path-visibility")) {
+	    settings.path_visibility = true;
+	  }
+	  if(args[i] == std::string("--depth-prepass")) {
+	    settings.depth_prepass = true;
+	  }
+	  if(args[i] == std::string("--material-permutations")) {
+	    settings.material_permutations = true;
+	  }
+	  if(args[i] == std::string("--texture-residency")) {
+	    settings.texture_budget = std::max(0, std::stoi(args[++i]));
+	  }
+	}
+
+	// Read after all arguments, as the implied scene times depend on --path-fps
+	if(settings.followPath) {
+	  settings.pathViews = getPathDecomposed(settings.pathFile, &settings.pathTimes, settings.path_fps);
 	}
 
 	if(settings.feature_buffers.size() != settings.output_prefixes.size()) {
@@ -862,6 +938,13 @@ void VulkanExampleBase::initVulkan()
 	if (deviceFeatures.samplerAnisotropy) {
 		enabledFeatures.samplerAnisotropy = VK_TRUE;
 	}
+	if (settings.indirect_draw) {
+		enabledFeatures.multiDrawIndirect = deviceFeatures.multiDrawIndirect;
+		enabledFeatures.drawIndirectFirstInstance = deviceFeatures.drawIndirectFirstInstance;
+	}
+	if (settings.bindless) {
+		enabledFeatures.shaderSampledImageArrayDynamicIndexing = deviceFeatures.shaderSampledImageArrayDynamicIndexing;
+	}
 	std::vector<const char*> enabledExtensions{};
 	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledExtensions);
 	if (res != VK_SUCCESS) {
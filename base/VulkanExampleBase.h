@@ -137,12 +137,31 @@ public:
 		bool multiSampling = false;
 		VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT;
 	    bool followPath = false;
+	    std::string pathFile;
 	    std::vector<std::pair<glm::vec3, glm::vec3> > pathViews;
+	    std::vector<float> pathTimes;         // Scene time of each path frame in seconds
+	    float path_fps = 60.0f;               // Implied scene time of path checkpoints without a "time" entry
 	    std::string sceneFile;
 	  std::vector<std::string> feature_buffers;
 	  std::vector<std::string> output_prefixes;
 	  int start_index = 0;
 	  int interval_t0 = -1, interval_t1 = -1;
+	  std::string preview_format;             // "png" or "jpg", empty disables preview output
+	  std::string preview_mode = "auto";      // auto, tonemap, normalize, clamp or signed
+	  int preview_downscale = 1;
+	  int preview_quality = 90;               // JPEG quality
+	  int writer_threads = 0;                 // 0 uses one thread per core
+	  int update_threads = 1;                 // Threads for the per-frame scene update including the render thread, 0 uses one per core
+	  bool compute_skinning = false;          // Deform skinned meshes in a compute pre-pass instead of the vertex shader
+	  bool indirect_draw = false;             // Draw the scene with indirect multi-draws reading per draw data from storage buffers
+	  bool bindless = false;                  // Index all model textures from one descriptor array instead of per material sets, implies indirect_draw
+	  bool cpu_culling = false;               // Frustum cull the draw list on the CPU and re-record the scene each frame
+	  bool gpu_culling = false;               // Frustum cull the indirect draws in a compute pass each frame, implies indirect_draw
+	  bool occlusion_culling = false;         // Two-phase depth pyramid occlusion culling on top of gpu_culling, implies it
+	  bool path_visibility = false;           // Precompute the visible draws of every --path frame and only draw those
+	  bool depth_prepass = false;             // Lay down opaque and masked depth first, then shade only fragments with equal depth
+	  bool material_permutations = false;     // Draw each material permutation with a PBR pipeline specialized for it, created on first use
+	  int texture_budget = -1;                // With a --path, upload only the texture mips it needs within this many MB, 0 is unbounded, -1 uploads full textures
 	} settings;
 	
 	struct DepthStencil {
@@ -15,6 +15,11 @@
 
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.hpp"
+#include "transformhierarchy.hpp"
+#include "animation.hpp"
+#include "frustumculling.hpp"
+#include "bvh.hpp"
+#include "pathvisibility.hpp"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -40,9 +45,6 @@
 #include <android/asset_manager.h>
 #endif
 
-// Changing this value here also requires changing it in the vertex shader
-#define MAX_NUM_JOINTS 128u
-
 namespace vkglTF
 {
 	struct Node;
@@ -96,15 +98,17 @@ namespace vkglTF
 	*/
 	struct Texture {
 		vks::VulkanDevice *device;
-		VkImage image;
+		VkImage image = VK_NULL_HANDLE;
 		VkImageLayout imageLayout;
-		VkDeviceMemory deviceMemory;
-		VkImageView view;
+		VkDeviceMemory deviceMemory = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
 		uint32_t width, height;
 		uint32_t mipLevels;
 		uint32_t layerCount;
 		VkDescriptorImageInfo descriptor;
-		VkSampler sampler;
+		VkSampler sampler = VK_NULL_HANDLE;
+		// Mip levels of the source image not uploaded, width, height and mipLevels describe the uploaded part
+		uint32_t baseLevel = 0;
 
 		void updateDescriptor()
 		{
@@ -124,8 +128,9 @@ namespace vkglTF
 		/*
 			Load a texture from a glTF image (stored as vector of chars loaded via stb_image)
 			Also generates the mip chain as glTF images are stored as jpg or png without any mips
+			The first skipLevels levels are dropped on the host, so the image only holds the levels from there on
 		*/
-		void fromglTfImage(tinygltf::Image &gltfimage, TextureSampler textureSampler, vks::VulkanDevice *device, VkQueue copyQueue)
+		void fromglTfImage(tinygltf::Image &gltfimage, TextureSampler textureSampler, vks::VulkanDevice *device, VkQueue copyQueue, uint32_t skipLevels = 0)
 		{
 			this->device = device;
 
@@ -159,6 +164,15 @@ namespace vkglTF
 
 			width = gltfimage.width;
 			height = gltfimage.height;
+			const unsigned char *pixels = buffer;
+			std::vector<unsigned char> reduced;
+			for (baseLevel = 0; baseLevel < skipLevels && (width > 1 || height > 1); baseLevel++) {
+				reduced = halveImage(pixels, width, height);
+				pixels = reduced.data();
+				width = std::max(width / 2, 1u);
+				height = std::max(height / 2, 1u);
+				bufferSize = width * height * 4;
+			}
 			mipLevels = static_cast<uint32_t>(floor(log2(std::max(width, height))) + 1.0);
 
 			vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
@@ -186,7 +200,7 @@ namespace vkglTF
 
 			uint8_t *data;
 			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void **)&data));
-			memcpy(data, buffer, bufferSize);
+			memcpy(data, pixels, bufferSize);
 			vkUnmapMemory(device->logicalDevice, stagingMemory);
 
 			VkImageCreateInfo imageCreateInfo{};
@@ -361,6 +375,38 @@ namespace vkglTF
 				delete[] buffer;
 
 		}
+
+		// Next mip level of an RGBA8 image, as the 2x2 box filter of each texel's footprint clamped to the edges
+		static std::vector<unsigned char> halveImage(const unsigned char *pixels, uint32_t width, uint32_t height)
+		{
+			const uint32_t halfWidth = std::max(width / 2, 1u);
+			const uint32_t halfHeight = std::max(height / 2, 1u);
+			std::vector<unsigned char> result(halfWidth * halfHeight * 4);
+			for (uint32_t y = 0; y < halfHeight; y++) {
+				const uint32_t y0 = std::min(2 * y, height - 1);
+				const uint32_t y1 = std::min(2 * y + 1, height - 1);
+				for (uint32_t x = 0; x < halfWidth; x++) {
+					const uint32_t x0 = std::min(2 * x, width - 1);
+					const uint32_t x1 = std::min(2 * x + 1, width - 1);
+					for (uint32_t c = 0; c < 4; c++) {
+						const uint32_t sum = pixels[(y0 * width + x0) * 4 + c] + pixels[(y0 * width + x1) * 4 + c] +
+							pixels[(y1 * width + x0) * 4 + c] + pixels[(y1 * width + x1) * 4 + c];
+						result[(y * halfWidth + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+					}
+				}
+			}
+			return result;
+		}
+
+		// Device memory of the uploaded RGBA8 image with skipLevels of a width x height source skipped, without alignment
+		static VkDeviceSize residentSize(uint32_t width, uint32_t height, uint32_t skipLevels)
+		{
+			VkDeviceSize size = 0;
+			for (uint32_t level = skipLevels; (width >> level) > 0 || (height >> level) > 0; level++) {
+				size += VkDeviceSize(std::max(width >> level, 1u)) * std::max(height >> level, 1u) * 4;
+			}
+			return size;
+		}
 	};
 
 	/*
@@ -398,6 +444,47 @@ namespace vkglTF
 			bool specularGlossiness = false;
 		} pbrWorkflows;
 		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		/*
+			Shader permutation the material needs, matching PERMUTATION in pbr_khr.frag
+			Two bits per texture slot (color, physical descriptor, normal, occlusion, emissive) holding the texture
+			coordinate set + 1 or 0 for an unused slot, then one bit for the specular glossiness workflow and one for alpha masking
+		*/
+		uint32_t permutation = 0;
+
+		static const uint32_t PERMUTATION_SPECULAR_GLOSSINESS = 1 << 10;
+		static const uint32_t PERMUTATION_ALPHA_MASK = 1 << 11;
+
+		// Slots and workflow resolve the same way as the material push constants do
+		void updatePermutation()
+		{
+			const Texture *color = nullptr;
+			const Texture *physical = nullptr;
+			uint8_t physicalSet = 0;
+			if (pbrWorkflows.metallicRoughness) {
+				color = baseColorTexture;
+				physical = metallicRoughnessTexture;
+				physicalSet = texCoordSets.metallicRoughness;
+			}
+			if (pbrWorkflows.specularGlossiness) {
+				color = extension.diffuseTexture;
+				physical = extension.specularGlossinessTexture;
+				physicalSet = texCoordSets.specularGlossiness;
+			}
+			const Texture *slots[5] = { color, physical, normalTexture, occlusionTexture, emissiveTexture };
+			const uint8_t sets[5] = { texCoordSets.baseColor, physicalSet, texCoordSets.normal, texCoordSets.occlusion, texCoordSets.emissive };
+			permutation = 0;
+			for (uint32_t i = 0; i < 5; i++) {
+				if (slots[i]) {
+					permutation |= std::min<uint32_t>(sets[i] + 1, 3) << (2 * i);
+				}
+			}
+			if (pbrWorkflows.specularGlossiness) {
+				permutation |= PERMUTATION_SPECULAR_GLOSSINESS;
+			}
+			if (alphaMode == ALPHAMODE_MASK) {
+				permutation |= PERMUTATION_ALPHA_MASK;
+			}
+		}
 	};
 
 	/*
@@ -406,9 +493,15 @@ namespace vkglTF
 	struct Primitive {
 		uint32_t firstIndex;
 		uint32_t indexCount;
+		uint32_t firstVertex = 0;
 		uint32_t vertexCount;
+		// Morph targets, targetCount streams of vertexCount deltas each from firstDelta on in Model::morphDeltas
+		uint32_t firstDelta = 0;
+		uint32_t targetCount = 0;
 		Material &material;
 		bool hasIndices;
+		// Mesh space units per texture coordinate unit of each UV set, from the summed triangle areas, 0 if degenerate
+		float worldPerUV[2] = { 0.0f, 0.0f };
 
 		BoundingBox bb;
 
@@ -423,52 +516,26 @@ namespace vkglTF
 		}
 	};
 
+	/*
+		Position and normal offset of one vertex for one morph target
+	*/
+	struct MorphDelta {
+		glm::vec3 position;
+		glm::vec3 normal;
+	};
+
 	/*
 		glTF mesh
+		The mesh's index in Model::meshes is also the index of its block in the model's node buffer
 	*/
 	struct Mesh {
-		vks::VulkanDevice *device;
-
-		std::vector<Primitive*> primitives;
+		// Range in Model::primitives
+		uint32_t firstPrimitive = 0;
+		uint32_t primitiveCount = 0;
 
 		BoundingBox bb;
 		BoundingBox aabb;
 
-		struct UniformBuffer {
-			VkBuffer buffer;
-			VkDeviceMemory memory;
-			VkDescriptorBufferInfo descriptor;
-			VkDescriptorSet descriptorSet;
-			void *mapped;
-		} uniformBuffer;
-
-		struct UniformBlock {
-			glm::mat4 matrix;
-			glm::mat4 jointMatrix[MAX_NUM_JOINTS]{};
-			float jointcount{ 0 };
-		} uniformBlock;
-
-		Mesh(vks::VulkanDevice *device, glm::mat4 matrix) {
-			this->device = device;
-			this->uniformBlock.matrix = matrix;
-			VK_CHECK_RESULT(device->createBuffer(
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				sizeof(uniformBlock),
-				&uniformBuffer.buffer,
-				&uniformBuffer.memory,
-				&uniformBlock));
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, uniformBuffer.memory, 0, sizeof(uniformBlock), 0, &uniformBuffer.mapped));
-			uniformBuffer.descriptor = { uniformBuffer.buffer, 0, sizeof(uniformBlock) };
-		};
-
-		~Mesh() {
-			vkDestroyBuffer(device->logicalDevice, uniformBuffer.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, uniformBuffer.memory, nullptr);
-			for (Primitive* p : primitives)
-				delete p;
-		}
-
 		void setBoundingBox(glm::vec3 min, glm::vec3 max) {
 			bb.min = min;
 			bb.max = max;
@@ -481,108 +548,84 @@ namespace vkglTF
 	*/
 	struct Skin {
 		std::string name;
-		Node *skeletonRoot = nullptr;
-		std::vector<glm::mat4> inverseBindMatrices;
-		std::vector<Node*> joints;
+		int32_t skeletonRoot = -1;
+		/*
+			Joint nodes and inverse bind matrices are stored in Model::joints and Model::inverseBindMatrices from jointOffset on,
+			which is also the start of this skin's joint palette in the model's joint buffer
+		*/
+		uint32_t jointOffset = 0;
+		uint32_t jointCount = 0;
 	};
 
 	/*
 		glTF node
+		Nodes are stored in Model::linearNodes in depth-first pre-order, a node's index there is also its index in
+		Model::hierarchy, which holds its local TRS and world matrix
+		Relationships are indices into the model's arrays, -1 for none
 	*/
 	struct Node {
-		Node *parent;
+		int32_t parent = -1;
+		// glTF node index
 		uint32_t index;
-		std::vector<Node*> children;
-		glm::mat4 matrix;
+		// Range in Model::nodeChildren
+		uint32_t firstChild = 0;
+		uint32_t childCount = 0;
 		std::string name;
-		Mesh *mesh;
-		Skin *skin;
-		int32_t skinIndex = -1;
-		glm::vec3 translation{};
-		glm::vec3 scale{ 1.0f };
-		glm::quat rotation{};
+		int32_t mesh = -1;
+		int32_t skin = -1;
 		BoundingBox bvh;
 		BoundingBox aabb;
+	};
 
-		glm::mat4 localMatrix() {
-			return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
-		}
-
-		glm::mat4 getMatrix() {
-			glm::mat4 m = localMatrix();
-			vkglTF::Node *p = parent;
-			while (p) {
-				m = p->localMatrix() * m;
-				p = p->parent;
-			}
-			return m;
-		}
-
-		void update() {
-			if (mesh) {
-				glm::mat4 m = getMatrix();
-				if (skin) {
-					mesh->uniformBlock.matrix = m;
-					// Update join matrices
-					glm::mat4 inverseTransform = glm::inverse(m);
-					size_t numJoints = std::min((uint32_t)skin->joints.size(), MAX_NUM_JOINTS);
-					for (size_t i = 0; i < numJoints; i++) {
-						vkglTF::Node *jointNode = skin->joints[i];
-						glm::mat4 jointMat = jointNode->getMatrix() * skin->inverseBindMatrices[i];
-						jointMat = inverseTransform * jointMat;
-						mesh->uniformBlock.jointMatrix[i] = jointMat;
-					}
-					mesh->uniformBlock.jointcount = (float)numJoints;
-					memcpy(mesh->uniformBuffer.mapped, &mesh->uniformBlock, sizeof(mesh->uniformBlock));
-				} else {
-					memcpy(mesh->uniformBuffer.mapped, &m, sizeof(glm::mat4));
-				}
-			}
-
-			for (auto& child : children) {
-				child->update();
-			}
-		}
-
-		~Node() {
-			if (mesh) {
-				delete mesh;
-			}
-			for (auto& child : children) {
-				delete child;
-			}
-		}
+	/*
+		One primitive draw of the model's draw list, with the state it needs
+	*/
+	struct DrawCommand {
+		Material::AlphaMode alphaMode;
+		// Index in Model::materials
+		uint32_t material;
+		// Node block of the mesh instance, see Model::nodeBlockOffset
+		uint32_t mesh;
+		uint32_t primitive;
 	};
 
 	/*
-		glTF animation channel
+		Per draw data of indirect draws, read by the vertex shader through the draw's firstInstance
+		nodeBlock is the offset of the mesh's node block in the node buffer in 16 byte units
 	*/
-	struct AnimationChannel {
-		enum PathType { TRANSLATION, ROTATION, SCALE };
-		PathType path;
-		Node *node;
-		uint32_t samplerIndex;
+	struct DrawData {
+		uint32_t nodeBlock;
+		uint32_t material;
 	};
 
 	/*
-		glTF animation sampler
+		Per draw input of the GPU culling pass (see data/shaders/cull.comp)
+		min and max are the primitive's bounds in mesh space, visible draws of batch are compacted from firstDraw on
 	*/
-	struct AnimationSampler {
-		enum InterpolationType { LINEAR, STEP, CUBICSPLINE };
-		InterpolationType interpolation;
-		std::vector<float> inputs;
-		std::vector<glm::vec4> outputsVec4;
+	struct DrawCullData {
+		enum Flags : uint32_t {
+			// The bounds are valid and not changed by skinning or morph targets
+			CULL_BOUNDS = 1,
+			// Blended draws keep their slot, so compaction does not change their order
+			KEEP_ORDER = 2
+		};
+		glm::vec4 min;
+		glm::vec4 max;
+		uint32_t batch;
+		uint32_t firstDraw;
+		uint32_t flags;
+		uint32_t padding;
 	};
 
 	/*
-		glTF animation
+		Consecutive draws of the draw list sharing pipeline and material, recorded as one indirect multi-draw
 	*/
-	struct Animation {
-		std::string name;
-		std::vector<AnimationSampler> samplers;
-		std::vector<AnimationChannel> channels;
-		float start = std::numeric_limits<float>::max();
-		float end = std::numeric_limits<float>::min();
+	struct DrawBatch {
+		Material::AlphaMode alphaMode;
+		uint32_t material;
+		uint32_t firstDraw;
+		uint32_t drawCount;
+		bool indexed;
 	};
 
 	/*
@@ -613,13 +656,155 @@ namespace vkglTF
 
 		glm::mat4 aabb;
 
-		std::vector<Node*> nodes;
-		std::vector<Node*> linearNodes;
+		/*
+			Scene graph storage, all relationships are 32 bit indices into these arrays
+			Nodes, meshes and primitives are appended while loading and never move or get freed individually
+		*/
+		std::vector<Node> linearNodes;
+		// Root nodes
+		std::vector<uint32_t> nodes;
+		std::vector<uint32_t> nodeChildren;
+		// Index in linearNodes for each glTF node index, -1 for nodes not part of the loaded scene
+		std::vector<int32_t> nodeLookup;
+		std::vector<Mesh> meshes;
+		std::vector<Primitive> primitives;
+		std::vector<Skin> skins;
+		std::vector<uint32_t> joints;
+		std::vector<glm::mat4> inverseBindMatrices;
+		std::vector<MorphDelta> morphDeltas;
+		/*
+			All primitive draws, flattened once after loading (see buildDrawList)
+			Grouped by alpha mode in drawing order: opaque, masked, blended
+		*/
+		std::vector<DrawCommand> drawList;
+		std::vector<DrawBatch> drawBatches;
+
+		TransformHierarchy hierarchy;
+		// Current morph target weights of each node, indexed like the hierarchy
+		MorphWeights morphWeights;
+
+		/*
+			Transforms of all meshes live in one host visible uniform buffer with one NodeBlock per mesh,
+			bound with a dynamic offset (see nodeBlockOffset). Joint palettes are stored once per skin in a separate
+			storage buffer and shared by all meshes using that skin
+		*/
+		struct NodeBlock {
+			glm::mat4 matrix;
+			float jointCount;
+			uint32_t jointOffset;
+		};
+
+		struct HostBuffer {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceMemory memory;
+			VkDescriptorBufferInfo descriptor;
+			void *mapped = nullptr;
+		};
+		HostBuffer nodeBuffer;
+		HostBuffer jointBuffer;
+		HostBuffer morphWeightBuffer;
+		// Indirect draw commands and per draw data for drawList, firstInstance of draw i is i
+		HostBuffer drawCommandBuffer;
+		HostBuffer drawDataBuffer;
+		HostBuffer drawCullBuffer;
+		VkDeviceSize nodeBlockStride = 0;
+		// Host copy of each mesh's node block matrix, the node buffer itself may be slow to read back
+		std::vector<glm::mat4> meshMatrices;
+		// World bounds of drawList for CPU culling, box i belongs to draw i and is placed by meshMatrices
+		CullingBounds cullingBounds;
+		bool cullingBoundsDirty = true;
+		// Built over cullingBounds after loading and refit whenever they are refreshed
+		BoundingVolumeHierarchy bvh;
+		VkDescriptorSet nodeDescriptorSet = VK_NULL_HANDLE;
+		// Incremented whenever a joint palette or morph target weights change
+		uint32_t poseVersion = 0;
+
+		/*
+			Optional pool the per-frame update (animation sampling, world matrices, node blocks, joint palettes) is spread over
+			Meshes and skins each write their own block of the mapped buffers, so results are identical for any thread count
+		*/
+		vks::ThreadPool *updatePool = nullptr;
+		std::vector<uint8_t> skinUpdated;
 
-		std::vector<Skin*> skins;
+		/*
+			Poses sampled ahead of rendering by bakePoses, for the part of the model the baked animation moves
+			Per frame it holds the node blocks of the animated meshes, the palettes of the animated skins and the weights of
+			the nodes with weight channels, each in the order of the animated set and without uniform buffer padding
+			Everything else keeps the state it was loaded with
+		*/
+		struct PoseCache {
+			uint32_t frameCount = 0;
+			uint32_t appliedFrame = UINT32_MAX;
+			// Animated set: meshes below an animated node, skins with an animated joint, nodes with morph weight channels
+			std::vector<uint32_t> meshes;
+			std::vector<uint32_t> skins;
+			std::vector<uint32_t> weightNodes;
+			// Per frame sizes of jointMatrices and morphWeights
+			uint32_t jointCount = 0;
+			uint32_t weightCount = 0;
+			std::vector<NodeBlock> nodeBlocks;
+			std::vector<glm::mat4> jointMatrices;
+			std::vector<float> morphWeights;
+
+			void clear()
+			{
+				frameCount = 0;
+				appliedFrame = UINT32_MAX;
+				meshes.clear();
+				skins.clear();
+				weightNodes.clear();
+				jointCount = 0;
+				weightCount = 0;
+				nodeBlocks.clear();
+				jointMatrices.clear();
+				morphWeights.clear();
+			}
+
+			const NodeBlock *frameBlocks(uint32_t frame) const
+			{
+				return nodeBlocks.data() + frame * meshes.size();
+			}
+		} poseCache;
+
+		/*
+			Vertex deformation pre-pass: morphed and (with computeSkinning) skinned vertex ranges are deformed once per
+			pose into a device local copy of the vertex buffer (deformedVertices), which all draws then consume as static
+			geometry. Morph targets are always applied this way, skins only if computeSkinning was set before loading
+			A range's layout matches the push constants of the deform compute shader
+		*/
+		bool computeSkinning = false;
+		struct DeformRange {
+			uint32_t firstVertex;
+			uint32_t vertexCount;
+			uint32_t jointOffset;
+			uint32_t skinned;
+			uint32_t firstDelta;
+			uint32_t targetCount;
+			uint32_t firstWeight;
+		};
+		std::vector<DeformRange> deformRanges;
+		struct DeformedVertices {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceMemory memory;
+		} deformedVertices;
+		// Device local copy of morphDeltas read by the deform pass
+		struct MorphDeltaBuffer {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceMemory memory;
+		} morphDeltaBuffer;
 
 		std::vector<Texture> textures;
 		std::vector<TextureSampler> textureSamplers;
+		/*
+			With deferTextureUpload set before loading, textures only get their size and keep their decoded image until
+			uploadTextures, e.g. to upload only the mip levels planned by planTextureResidency
+		*/
+		bool deferTextureUpload = false;
+		struct PendingTexture {
+			tinygltf::Image image;
+			TextureSampler sampler;
+		};
+		std::vector<PendingTexture> pendingTextures;
 		std::vector<Material> materials;
 		std::vector<Animation> animations;
 		std::vector<std::string> extensions;
@@ -634,67 +819,118 @@ namespace vkglTF
 			if (vertices.buffer != VK_NULL_HANDLE) {
 				vkDestroyBuffer(device, vertices.buffer, nullptr);
 				vkFreeMemory(device, vertices.memory, nullptr);
+				vertices.buffer = VK_NULL_HANDLE;
+			}
+			if (deformedVertices.buffer != VK_NULL_HANDLE) {
+				vkDestroyBuffer(device, deformedVertices.buffer, nullptr);
+				vkFreeMemory(device, deformedVertices.memory, nullptr);
+				deformedVertices.buffer = VK_NULL_HANDLE;
 			}
+			if (morphDeltaBuffer.buffer != VK_NULL_HANDLE) {
+				vkDestroyBuffer(device, morphDeltaBuffer.buffer, nullptr);
+				vkFreeMemory(device, morphDeltaBuffer.memory, nullptr);
+				morphDeltaBuffer.buffer = VK_NULL_HANDLE;
+			}
+			deformRanges.resize(0);
+			morphDeltas.resize(0);
+			morphWeights = MorphWeights();
 			if (indices.buffer != VK_NULL_HANDLE) {
 				vkDestroyBuffer(device, indices.buffer, nullptr);
 				vkFreeMemory(device, indices.memory, nullptr);
 			}
+			for (HostBuffer *hostBuffer : { &nodeBuffer, &jointBuffer, &morphWeightBuffer, &drawCommandBuffer, &drawDataBuffer, &drawCullBuffer }) {
+				if (hostBuffer->buffer != VK_NULL_HANDLE) {
+					vkUnmapMemory(device, hostBuffer->memory);
+					vkDestroyBuffer(device, hostBuffer->buffer, nullptr);
+					vkFreeMemory(device, hostBuffer->memory, nullptr);
+					hostBuffer->buffer = VK_NULL_HANDLE;
+				}
+			}
 			for (auto texture : textures) {
 				texture.destroy();
 			}
 			textures.resize(0);
 			textureSamplers.resize(0);
-			for (auto node : nodes) {
-				delete node;
-			}
+			pendingTextures.resize(0);
 			materials.resize(0);
 			animations.resize(0);
-			nodes.resize(0);
+			poseCache.clear();
+			drawList.resize(0);
+			drawBatches.resize(0);
+			cullingBounds.clear();
+			bvh.clear();
+			meshMatrices.resize(0);
 			linearNodes.resize(0);
-			extensions.resize(0);
+			nodes.resize(0);
+			nodeChildren.resize(0);
+			nodeLookup.resize(0);
+			meshes.resize(0);
+			// Primitives hold material references and cannot be default constructed by resize
+			primitives.clear();
 			skins.resize(0);
+			joints.resize(0);
+			inverseBindMatrices.resize(0);
+			hierarchy.clear();
+			extensions.resize(0);
 		};
 
-		void loadNode(vkglTF::Node *parent, const tinygltf::Node &node, uint32_t nodeIndex, const tinygltf::Model &model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale)
+		// Returns the index of the new node in linearNodes
+		uint32_t loadNode(int32_t parent, const tinygltf::Node &node, uint32_t nodeIndex, const tinygltf::Model &model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale)
 		{
-			vkglTF::Node *newNode = new Node{};
+			// Appended before the children are loaded, which keeps nodes in parent-before-child order
+			const uint32_t newIndex = static_cast<uint32_t>(linearNodes.size());
+			linearNodes.push_back(Node{});
+			Node *newNode = &linearNodes.back();
 			newNode->index = nodeIndex;
 			newNode->parent = parent;
 			newNode->name = node.name;
-			newNode->skinIndex = node.skin;
-			newNode->matrix = glm::mat4(1.0f);
+			newNode->skin = node.skin;
+			if (nodeIndex < nodeLookup.size() && nodeLookup[nodeIndex] < 0) {
+				nodeLookup[nodeIndex] = static_cast<int32_t>(newIndex);
+			}
+			// Weights are assigned once the node's mesh is loaded
+			morphWeights.offsets.push_back(0);
+			morphWeights.counts.push_back(0);
 
-			// Generate local node matrix
+			// Generate local node transform
 			glm::vec3 translation = glm::vec3(0.0f);
 			if (node.translation.size() == 3) {
 				translation = glm::make_vec3(node.translation.data());
-				newNode->translation = translation;
 			}
-			newNode->rotation = glm::mat4(1.0f);
+			glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
 			if (node.rotation.size() == 4) {
-				glm::quat q = glm::make_quat(node.rotation.data());
-				newNode->rotation = glm::mat4(q);
+				rotation = glm::make_quat(node.rotation.data());
 			}
 			glm::vec3 scale = glm::vec3(1.0f);
 			if (node.scale.size() == 3) {
 				scale = glm::make_vec3(node.scale.data());
-				newNode->scale = scale;
 			}
+			glm::mat4 matrix = glm::mat4(1.0f);
 			if (node.matrix.size() == 16) {
-				newNode->matrix = glm::make_mat4x4(node.matrix.data());
+				matrix = glm::make_mat4x4(node.matrix.data());
 			};
-
-			// Node with children
-			if (node.children.size() > 0) {
-				for (size_t i = 0; i < node.children.size(); i++) {
-					loadNode(newNode, model.nodes[node.children[i]], node.children[i], model, indexBuffer, vertexBuffer, globalscale);
-				}
+			hierarchy.add(parent, translation, rotation, scale, matrix);
+
+			// Node with children, their slots are reserved up front as loading them appends further children
+			const uint32_t firstChild = static_cast<uint32_t>(nodeChildren.size());
+			newNode->firstChild = firstChild;
+			newNode->childCount = static_cast<uint32_t>(node.children.size());
+			nodeChildren.resize(nodeChildren.size() + node.children.size());
+			for (size_t i = 0; i < node.children.size(); i++) {
+				// Loaded before indexing, as loading grows nodeChildren and would leave the element reference dangling
+				const uint32_t child = loadNode(static_cast<int32_t>(newIndex), model.nodes[node.children[i]], node.children[i], model, indexBuffer, vertexBuffer, globalscale);
+				nodeChildren[firstChild + i] = child;
 			}
+			// Loading the children may have reallocated the node array
+			newNode = &linearNodes[newIndex];
 
 			// Node contains mesh data
 			if (node.mesh > -1) {
 				const tinygltf::Mesh mesh = model.meshes[node.mesh];
-				Mesh *newMesh = new Mesh(device, newNode->matrix);
+				newNode->mesh = static_cast<int32_t>(meshes.size());
+				meshes.push_back(Mesh{});
+				Mesh *newMesh = &meshes.back();
+				newMesh->firstPrimitive = static_cast<uint32_t>(primitives.size());
 				for (size_t j = 0; j < mesh.primitives.size(); j++) {
 					const tinygltf::Primitive &primitive = mesh.primitives[j];
 					uint32_t indexStart = static_cast<uint32_t>(indexBuffer.size());
@@ -782,6 +1018,30 @@ namespace vkglTF
 							vertexBuffer.push_back(vert);
 						}
 					}
+					// Morph targets
+					const uint32_t firstDelta = static_cast<uint32_t>(morphDeltas.size());
+					for (const std::map<std::string, int> &target : primitive.targets) {
+						const size_t targetDelta = morphDeltas.size();
+						morphDeltas.resize(targetDelta + vertexCount, MorphDelta{ glm::vec3(0.0f), glm::vec3(0.0f) });
+						for (const char *attribute : { "POSITION", "NORMAL" }) {
+							if (target.find(attribute) == target.end()) {
+								continue;
+							}
+							const tinygltf::Accessor &accessor = model.accessors[target.find(attribute)->second];
+							if (accessor.bufferView < 0 || accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT || accessor.type != TINYGLTF_TYPE_VEC3 || accessor.count < vertexCount) {
+								std::cout << "Morph target " << attribute << " format not supported, skipping" << std::endl;
+								continue;
+							}
+							const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+							const float *buffer = reinterpret_cast<const float *>(&(model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
+							const int byteStride = accessor.ByteStride(view) ? (accessor.ByteStride(view) / sizeof(float)) : tinygltf::GetTypeSizeInBytes(TINYGLTF_TYPE_VEC3);
+							const bool position = std::string(attribute) == "POSITION";
+							for (uint32_t v = 0; v < vertexCount; v++) {
+								glm::vec3 &delta = position ? morphDeltas[targetDelta + v].position : morphDeltas[targetDelta + v].normal;
+								delta = glm::make_vec3(&buffer[v * byteStride]);
+							}
+						}
+					}
 					// Indices
 					if (hasIndices)
 					{
@@ -816,59 +1076,95 @@ namespace vkglTF
 						}
 						default:
 							std::cerr << "Index component type " << accessor.componentType << " not supported!" << std::endl;
-							return;
+							return newIndex;
 						}
 					}					
-					Primitive *newPrimitive = new Primitive(indexStart, indexCount, vertexCount, primitive.material > -1 ? materials[primitive.material] : materials.back());
-					newPrimitive->setBoundingBox(posMin, posMax);
-					newMesh->primitives.push_back(newPrimitive);
+					Primitive newPrimitive(indexStart, indexCount, vertexCount, primitive.material > -1 ? materials[primitive.material] : materials.back());
+					newPrimitive.firstVertex = vertexStart;
+					newPrimitive.firstDelta = firstDelta;
+					newPrimitive.targetCount = static_cast<uint32_t>(primitive.targets.size());
+					newPrimitive.setBoundingBox(posMin, posMax);
+					measureTexelDensity(newPrimitive, indexBuffer, vertexBuffer);
+					primitives.push_back(newPrimitive);
+					newMesh->primitiveCount++;
+				}
+				// Default morph target weights, the node's own take precedence over the mesh's
+				uint32_t targetCount = 0;
+				for (uint32_t i = newMesh->firstPrimitive; i < newMesh->firstPrimitive + newMesh->primitiveCount; i++) {
+					targetCount = std::max(targetCount, primitives[i].targetCount);
+				}
+				if (targetCount > 0) {
+					const std::vector<double> &weights = node.weights.size() == targetCount ? node.weights : mesh.weights;
+					morphWeights.offsets[newIndex] = static_cast<uint32_t>(morphWeights.values.size());
+					morphWeights.counts[newIndex] = targetCount;
+					for (uint32_t i = 0; i < targetCount; i++) {
+						morphWeights.values.push_back(i < weights.size() ? static_cast<float>(weights[i]) : 0.0f);
+					}
 				}
 				// Mesh BB from BBs of primitives
-				for (auto p : newMesh->primitives) {
-					if (p->bb.valid && !newMesh->bb.valid) {
-						newMesh->bb = p->bb;
+				for (uint32_t i = newMesh->firstPrimitive; i < newMesh->firstPrimitive + newMesh->primitiveCount; i++) {
+					const Primitive &p = primitives[i];
+					if (p.bb.valid && !newMesh->bb.valid) {
+						newMesh->bb = p.bb;
 						newMesh->bb.valid = true;
 					}
-					newMesh->bb.min = glm::min(newMesh->bb.min, p->bb.min);
-					newMesh->bb.max = glm::max(newMesh->bb.max, p->bb.max);
+					newMesh->bb.min = glm::min(newMesh->bb.min, p.bb.min);
+					newMesh->bb.max = glm::max(newMesh->bb.max, p.bb.max);
 				}
-				newNode->mesh = newMesh;
 			}
-			if (parent) {
-				parent->children.push_back(newNode);
-			} else {
-				nodes.push_back(newNode);
+			if (parent < 0) {
+				nodes.push_back(newIndex);
+			}
+			return newIndex;
+		}
+
+		// Load the node trees of the default scene, filling nodeLookup for the skins and animations loaded afterwards
+		void loadNodes(const tinygltf::Model &gltfModel, std::vector<uint32_t> &indexBuffer, std::vector<Vertex> &vertexBuffer, float scale)
+		{
+			// TODO: scene handling with no default scene
+			const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
+			linearNodes.reserve(gltfModel.nodes.size());
+			nodeLookup.assign(gltfModel.nodes.size(), -1);
+			meshes.reserve(gltfModel.meshes.size());
+			for (size_t i = 0; i < scene.nodes.size(); i++) {
+				const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
+				loadNode(-1, node, scene.nodes[i], gltfModel, indexBuffer, vertexBuffer, scale);
 			}
-			linearNodes.push_back(newNode);
 		}
 
 		void loadSkins(tinygltf::Model &gltfModel)
 		{
+			skins.reserve(gltfModel.skins.size());
 			for (tinygltf::Skin &source : gltfModel.skins) {
-				Skin *newSkin = new Skin{};
-				newSkin->name = source.name;
+				Skin newSkin{};
+				newSkin.name = source.name;
+				newSkin.jointOffset = static_cast<uint32_t>(joints.size());
 				
 				// Find skeleton root node
 				if (source.skeleton > -1) {
-					newSkin->skeletonRoot = nodeFromIndex(source.skeleton);
-				}
-
-				// Find joint nodes
-				for (int jointIndex : source.joints) {
-					Node* node = nodeFromIndex(jointIndex);
-					if (node) {
-						newSkin->joints.push_back(nodeFromIndex(jointIndex));
-					}
+					newSkin.skeletonRoot = nodeFromIndex(source.skeleton);
 				}
 
 				// Get inverse bind matrices from buffer
+				const glm::mat4 *sourceMatrices = nullptr;
+				size_t sourceMatrixCount = 0;
 				if (source.inverseBindMatrices > -1) {
 					const tinygltf::Accessor &accessor = gltfModel.accessors[source.inverseBindMatrices];
 					const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
 					const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
-					newSkin->inverseBindMatrices.resize(accessor.count);
-					memcpy(newSkin->inverseBindMatrices.data(), &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::mat4));
+					sourceMatrices = reinterpret_cast<const glm::mat4*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]);
+					sourceMatrixCount = accessor.count;
+				}
+
+				// Find joint nodes, missing inverse bind matrices default to identity
+				for (size_t i = 0; i < source.joints.size(); i++) {
+					const int32_t node = nodeFromIndex(source.joints[i]);
+					if (node > -1) {
+						joints.push_back(static_cast<uint32_t>(node));
+						inverseBindMatrices.push_back(i < sourceMatrixCount ? sourceMatrices[i] : glm::mat4(1.0f));
+					}
 				}
+				newSkin.jointCount = static_cast<uint32_t>(joints.size()) - newSkin.jointOffset;
 
 				skins.push_back(newSkin);
 			}
@@ -891,11 +1187,56 @@ namespace vkglTF
 					textureSampler = textureSamplers[tex.sampler];
 				}
 				vkglTF::Texture texture;
-				texture.fromglTfImage(image, textureSampler, device, transferQueue);
+				if (deferTextureUpload) {
+					texture.device = device;
+					texture.width = image.width;
+					texture.height = image.height;
+					texture.mipLevels = static_cast<uint32_t>(floor(log2(std::max(image.width, image.height))) + 1.0);
+					pendingTextures.push_back(PendingTexture{ image, textureSampler });
+				} else {
+					texture.fromglTfImage(image, textureSampler, device, transferQueue);
+				}
 				textures.push_back(texture);
 			}
 		}
 
+		/*
+			Upload the deferred textures, skipping skipLevels[i] mip levels of texture i (all levels if empty)
+			Textures are uploaded in place, so material texture pointers stay valid
+		*/
+		void uploadTextures(const std::vector<uint32_t> &skipLevels, VkQueue transferQueue)
+		{
+			for (size_t i = 0; i < pendingTextures.size(); i++) {
+				textures[i].fromglTfImage(pendingTextures[i].image, pendingTextures[i].sampler, device, transferQueue, skipLevels.empty() ? 0 : skipLevels[i]);
+			}
+			pendingTextures.clear();
+		}
+
+		/*
+			Texel density of a primitive's UV sets as the square root of the ratio of its summed mesh space and UV space
+			triangle areas
+		*/
+		static void measureTexelDensity(Primitive &primitive, const std::vector<uint32_t> &indexBuffer, const std::vector<Vertex> &vertexBuffer)
+		{
+			const uint32_t count = primitive.hasIndices ? primitive.indexCount : primitive.vertexCount;
+			double area = 0.0;
+			double uvArea[2] = { 0.0, 0.0 };
+			for (uint32_t i = 0; i + 2 < count; i += 3) {
+				const Vertex *v[3];
+				for (uint32_t j = 0; j < 3; j++) {
+					v[j] = &vertexBuffer[primitive.hasIndices ? indexBuffer[primitive.firstIndex + i + j] : primitive.firstVertex + i + j];
+				}
+				area += glm::length(glm::cross(v[1]->pos - v[0]->pos, v[2]->pos - v[0]->pos));
+				const glm::vec2 a0 = v[1]->uv0 - v[0]->uv0, b0 = v[2]->uv0 - v[0]->uv0;
+				const glm::vec2 a1 = v[1]->uv1 - v[0]->uv1, b1 = v[2]->uv1 - v[0]->uv1;
+				uvArea[0] += std::abs(a0.x * b0.y - a0.y * b0.x);
+				uvArea[1] += std::abs(a1.x * b1.y - a1.y * b1.x);
+			}
+			for (int set = 0; set < 2; set++) {
+				primitive.worldPerUV[set] = uvArea[set] > 0.0 ? static_cast<float>(std::sqrt(area / uvArea[set])) : 0.0f;
+			}
+		}
+
 		VkSamplerAddressMode getVkWrapMode(int32_t wrapMode) 
 		{
 			switch (wrapMode) {
@@ -1027,10 +1368,12 @@ namespace vkglTF
 					}
 				}
 
+				material.updatePermutation();
 				materials.push_back(material);
 			}
 			// Push a default material at the end of the list for meshes with no material assigned
 			materials.push_back(Material());
+			materials.back().updatePermutation();
 		}
 
 		void loadAnimations(tinygltf::Model &gltfModel)
@@ -1091,6 +1434,11 @@ namespace vkglTF
 						const void *dataPtr = &buffer.data[accessor.byteOffset + bufferView.byteOffset];
 
 						switch (accessor.type) {
+						case TINYGLTF_TYPE_SCALAR: {
+							const float *buf = static_cast<const float*>(dataPtr);
+							sampler.outputs.assign(buf, buf + accessor.count);
+							break;
+						}
 						case TINYGLTF_TYPE_VEC3: {
 							const glm::vec3 *buf = static_cast<const glm::vec3*>(dataPtr);
 							for (size_t index = 0; index < accessor.count; index++) {
@@ -1129,17 +1477,18 @@ namespace vkglTF
 						channel.path = AnimationChannel::PathType::SCALE;
 					}
 					if (source.target_path == "weights") {
-						std::cout << "weights not yet supported, skipping channel" << std::endl;
-						continue;
+						channel.path = AnimationChannel::PathType::WEIGHTS;
 					}
 					channel.samplerIndex = source.sampler;
-					channel.node = nodeFromIndex(source.target_node);
-					if (!channel.node) {
+					const int32_t node = nodeFromIndex(source.target_node);
+					if (node < 0) {
 						continue;
 					}
+					channel.node = static_cast<uint32_t>(node);
 
 					animation.channels.push_back(channel);
 				}
+				animation.compile();
 
 				animations.push_back(animation);
 			}
@@ -1169,27 +1518,36 @@ namespace vkglTF
 				loadTextureSamplers(gltfModel);
 				loadTextures(gltfModel, device, transferQueue);
 				loadMaterials(gltfModel);
-				// TODO: scene handling with no default scene
-				const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
-				for (size_t i = 0; i < scene.nodes.size(); i++) {
-					const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
-					loadNode(nullptr, node, scene.nodes[i], gltfModel, indexBuffer, vertexBuffer, scale);
-				}
+				loadNodes(gltfModel, indexBuffer, vertexBuffer, scale);
 				if (gltfModel.animations.size() > 0) {
 					loadAnimations(gltfModel);
 				}
 				loadSkins(gltfModel);
 
-				for (auto node : linearNodes) {
-					// Assign skins
-					if (node->skinIndex > -1) {
-						node->skin = skins[node->skinIndex];
+				createNodeBuffers();
+				for (uint32_t n = 0; n < linearNodes.size(); n++) {
+					const Node &node = linearNodes[n];
+					if (node.mesh < 0) {
+						continue;
 					}
-					// Initial pose
-					if (node->mesh) {
-						node->update();
+					const Mesh &mesh = meshes[node.mesh];
+					const bool skinned = computeSkinning && node.skin > -1;
+					for (uint32_t i = mesh.firstPrimitive; i < mesh.firstPrimitive + mesh.primitiveCount; i++) {
+						const Primitive &primitive = primitives[i];
+						if (skinned || primitive.targetCount > 0) {
+							deformRanges.push_back({ primitive.firstVertex, primitive.vertexCount, skinned ? skins[node.skin].jointOffset : 0, skinned ? 1u : 0u,
+								primitive.firstDelta, primitive.targetCount, morphWeights.offsets[n] });
+						}
 					}
 				}
+				buildDrawList();
+				createDrawBuffers();
+				// Initial pose
+				updateNodes();
+				updateMorphWeights();
+				cullingBounds.refresh(meshMatrices);
+				cullingBoundsDirty = false;
+				bvh.build(cullingBounds);
 			}
 			else {
 				// TODO: throw
@@ -1208,7 +1566,7 @@ namespace vkglTF
 			struct StagingBuffer {
 				VkBuffer buffer;
 				VkDeviceMemory memory;
-			} vertexStaging, indexStaging;
+			} vertexStaging, indexStaging, morphDeltaStaging{ VK_NULL_HANDLE, VK_NULL_HANDLE };
 
 			// Create staging buffers
 			// Vertex data
@@ -1231,13 +1589,31 @@ namespace vkglTF
 			}
 
 			// Create device local buffers
-			// Vertex buffer
+			// Vertex buffer, also read by the deform compute shader
+			const VkBufferUsageFlags skinningUsage = deformRanges.empty() ? 0 : VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 			VK_CHECK_RESULT(device->createBuffer(
-				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | skinningUsage,
 				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 				vertexBufferSize,
 				&vertices.buffer,
 				&vertices.memory));
+			// Deformed copy written by the deform compute shader, static ranges keep their initial contents
+			// The shader always binds the morph deltas, so there is a one element buffer even without morph targets
+			const size_t morphDeltaSize = std::max<size_t>(morphDeltas.size(), 1) * sizeof(MorphDelta);
+			if (!deformRanges.empty()) {
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					vertexBufferSize,
+					&deformedVertices.buffer,
+					&deformedVertices.memory));
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					morphDeltaSize,
+					&morphDeltaBuffer.buffer,
+					&morphDeltaBuffer.memory));
+			}
 			// Index buffer
 			if (indexBufferSize > 0) {
 				VK_CHECK_RESULT(device->createBuffer(
@@ -1255,6 +1631,20 @@ namespace vkglTF
 
 			copyRegion.size = vertexBufferSize;
 			vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
+			if (deformedVertices.buffer != VK_NULL_HANDLE) {
+				vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, deformedVertices.buffer, 1, &copyRegion);
+			}
+			if (!morphDeltas.empty() && morphDeltaBuffer.buffer != VK_NULL_HANDLE) {
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					morphDeltaSize,
+					&morphDeltaStaging.buffer,
+					&morphDeltaStaging.memory,
+					morphDeltas.data()));
+				copyRegion.size = morphDeltaSize;
+				vkCmdCopyBuffer(copyCmd, morphDeltaStaging.buffer, morphDeltaBuffer.buffer, 1, &copyRegion);
+			}
 
 			if (indexBufferSize > 0) {
 				copyRegion.size = indexBufferSize;
@@ -1269,68 +1659,84 @@ namespace vkglTF
 				vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
 				vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
 			}
+			if (morphDeltaStaging.buffer != VK_NULL_HANDLE) {
+				vkDestroyBuffer(device->logicalDevice, morphDeltaStaging.buffer, nullptr);
+				vkFreeMemory(device->logicalDevice, morphDeltaStaging.memory, nullptr);
+			}
 
 			getSceneDimensions();
 		}
 
-		void drawNode(Node *node, VkCommandBuffer commandBuffer)
+		void drawNode(const Node &node, VkCommandBuffer commandBuffer)
 		{
-			if (node->mesh) {
-				for (Primitive *primitive : node->mesh->primitives) {
-					vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, 0, 0);
+			if (node.mesh > -1) {
+				const Mesh &mesh = meshes[node.mesh];
+				for (uint32_t i = mesh.firstPrimitive; i < mesh.firstPrimitive + mesh.primitiveCount; i++) {
+					vkCmdDrawIndexed(commandBuffer, primitives[i].indexCount, 1, primitives[i].firstIndex, 0, 0);
 				}
 			}
-			for (auto& child : node->children) {
-				drawNode(child, commandBuffer);
-			}
+		}
+
+		// Vertex buffer to draw from, the deformed copy if compute skinning is used
+		const VkBuffer &drawVertexBuffer() const
+		{
+			return deformedVertices.buffer != VK_NULL_HANDLE ? deformedVertices.buffer : vertices.buffer;
 		}
 
 		void draw(VkCommandBuffer commandBuffer)
 		{
 			const VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &drawVertexBuffer(), offsets);
 			vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-			for (auto& node : nodes) {
+			// Nodes are stored in pre-order, which is the order a recursive traversal from the roots would draw them in
+			for (const Node &node : linearNodes) {
 				drawNode(node, commandBuffer);
 			}
 		}
 
-		void calculateBoundingBox(Node *node, Node *parent) {
-			BoundingBox parentBvh = parent ? parent->bvh : BoundingBox(dimensions.min, dimensions.max);
-
-			if (node->mesh) {
-				if (node->mesh->bb.valid) {
-					node->aabb = node->mesh->bb.getAABB(node->getMatrix());
-					if (node->children.size() == 0) {
-						node->bvh.min = node->aabb.min;
-						node->bvh.max = node->aabb.max;
-						node->bvh.valid = true;
-					}
+		/*
+			World bounds of all mesh nodes in aabb and of each node's subtree in bvh
+			Children follow their parent in linearNodes, so one reverse pass merges every subtree before its parent
+		*/
+		void calculateBoundingBoxes()
+		{
+			for (size_t i = 0; i < linearNodes.size(); i++) {
+				Node &node = linearNodes[i];
+				node.aabb = BoundingBox();
+				node.bvh = BoundingBox();
+				if (node.mesh > -1 && meshes[node.mesh].bb.valid) {
+					node.aabb = meshes[node.mesh].bb.getAABB(hierarchy.worldMatrices[i]);
+					node.aabb.valid = true;
+					node.bvh = node.aabb;
 				}
 			}
-
-			parentBvh.min = glm::min(parentBvh.min, node->bvh.min);
-			parentBvh.max = glm::min(parentBvh.max, node->bvh.max);
-
-			for (auto &child : node->children) {
-				calculateBoundingBox(child, node);
+			for (size_t i = linearNodes.size(); i-- > 0;) {
+				const Node &node = linearNodes[i];
+				if (node.parent < 0 || !node.bvh.valid) {
+					continue;
+				}
+				BoundingBox &parentBvh = linearNodes[node.parent].bvh;
+				if (parentBvh.valid) {
+					parentBvh.min = glm::min(parentBvh.min, node.bvh.min);
+					parentBvh.max = glm::max(parentBvh.max, node.bvh.max);
+				} else {
+					parentBvh = node.bvh;
+				}
 			}
 		}
 
 		void getSceneDimensions()
 		{
-			// Calculate binary volume hierarchy for all nodes in the scene
-			for (auto node : linearNodes) {
-				calculateBoundingBox(node, nullptr);
-			}
+			calculateBoundingBoxes();
 
 			dimensions.min = glm::vec3(FLT_MAX);
 			dimensions.max = glm::vec3(-FLT_MAX);
 
-			for (auto node : linearNodes) {
-				if (node->bvh.valid) {
-					dimensions.min = glm::min(dimensions.min, node->bvh.min);
-					dimensions.max = glm::max(dimensions.max, node->bvh.max);
+			// Root bounds cover their whole subtree
+			for (const Node &node : linearNodes) {
+				if (node.parent < 0 && node.bvh.valid) {
+					dimensions.min = glm::min(dimensions.min, node.bvh.min);
+					dimensions.max = glm::max(dimensions.max, node.bvh.max);
 				}
 			}
 
@@ -1348,83 +1754,638 @@ namespace vkglTF
 				std::cout << "No animation with index " << index << std::endl;
 				return;
 			}
-			Animation &animation = animations[index];
+			if (animations[index].evaluate(time, hierarchy, updatePool, &morphWeights)) {
+				updateDirtyNodes();
+			}
+			if (morphWeights.changed) {
+				updateMorphWeights();
+			}
+		}
 
-			bool updated = false;
-			for (auto& channel : animation.channels) {
-				vkglTF::AnimationSampler &sampler = animation.samplers[channel.samplerIndex];
-				if (sampler.inputs.size() > sampler.outputsVec4.size()) {
-					continue;
+		void createHostBuffer(HostBuffer &hostBuffer, VkBufferUsageFlags usage, VkDeviceSize size, VkDeviceSize range)
+		{
+			VK_CHECK_RESULT(device->createBuffer(
+				usage,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				size,
+				&hostBuffer.buffer,
+				&hostBuffer.memory));
+			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, hostBuffer.memory, 0, size, 0, &hostBuffer.mapped));
+			hostBuffer.descriptor = { hostBuffer.buffer, 0, range };
+		}
+
+		/*
+			Allocate the node block buffer and assign joint palette ranges to skins
+		*/
+		void createNodeBuffers()
+		{
+			// Blocks are also read as an array of vec4 by indirect draws, so they start at 16 byte boundaries
+			const VkDeviceSize alignment = std::max<VkDeviceSize>(device->properties.limits.minUniformBufferOffsetAlignment, 16);
+			nodeBlockStride = (sizeof(NodeBlock) + alignment - 1) / alignment * alignment;
+
+			const size_t meshCount = std::max<size_t>(meshes.size(), 1);
+			const size_t jointCount = std::max<size_t>(joints.size(), 1);
+			createHostBuffer(nodeBuffer, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, meshCount * nodeBlockStride, sizeof(NodeBlock));
+			meshMatrices.assign(meshCount, glm::mat4(1.0f));
+			createHostBuffer(jointBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, jointCount * sizeof(glm::mat4), VK_WHOLE_SIZE);
+			const size_t weightCount = std::max<size_t>(morphWeights.values.size(), 1);
+			createHostBuffer(morphWeightBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, weightCount * sizeof(float), VK_WHOLE_SIZE);
+		}
+
+		// Dynamic offset of a mesh's block in nodeBuffer
+		uint32_t nodeBlockOffset(uint32_t mesh) const
+		{
+			return static_cast<uint32_t>(mesh * nodeBlockStride);
+		}
+
+		// World matrix and joint palette range of a mesh node for the world matrices of the given hierarchy
+		NodeBlock meshBlock(const TransformHierarchy &source, uint32_t index) const
+		{
+			const Node &node = linearNodes[index];
+			const Skin *skin = node.skin > -1 ? &skins[node.skin] : nullptr;
+			NodeBlock block{
+				source.worldMatrices[index],
+				skin ? (float)skin->jointCount : 0.0f,
+				skin ? skin->jointOffset : 0 };
+			// Vertices of skinned meshes are already deformed into model space by the compute pass
+			if (skin && computeSkinning) {
+				block.matrix = glm::mat4(1.0f);
+				block.jointCount = 0.0f;
+			}
+			return block;
+		}
+
+		/*
+			Write the world matrix and joint palette range of a mesh node to the node buffer
+		*/
+		void updateMesh(uint32_t index)
+		{
+			const NodeBlock block = meshBlock(hierarchy, index);
+			memcpy(static_cast<char*>(nodeBuffer.mapped) + nodeBlockOffset(linearNodes[index].mesh), &block, sizeof(NodeBlock));
+			meshMatrices[linearNodes[index].mesh] = block.matrix;
+		}
+
+		/*
+			Evaluate the joint palette of a skin in model space into palette, which holds jointCount matrices
+			Skinned vertices are transformed by the palette alone, so the palette does not depend on the mesh
+			node and is shared by every mesh using the skin
+		*/
+		void evaluateSkin(const TransformHierarchy &source, const Skin &skin, glm::mat4 *palette) const
+		{
+			for (uint32_t i = 0; i < skin.jointCount; i++) {
+				palette[i] = source.worldMatrices[joints[skin.jointOffset + i]] * inverseBindMatrices[skin.jointOffset + i];
+			}
+		}
+
+		void updateSkin(const Skin &skin)
+		{
+			evaluateSkin(hierarchy, skin, static_cast<glm::mat4*>(jointBuffer.mapped) + skin.jointOffset);
+		}
+
+		// Upload the current morph target weights for the next deform pass
+		void updateMorphWeights()
+		{
+			if (!morphWeights.values.empty()) {
+				memcpy(morphWeightBuffer.mapped, morphWeights.values.data(), morphWeights.values.size() * sizeof(float));
+				poseVersion++;
+			}
+			morphWeights.changed = false;
+		}
+
+		// Node blocks of the meshes in a range of the hierarchy
+		void updateMeshes(uint32_t first, uint32_t last)
+		{
+			for (uint32_t i = first; i < last; i++) {
+				if (linearNodes[i].mesh > -1) {
+					updateMesh(i);
 				}
+			}
+		}
 
-				for (size_t i = 0; i < sampler.inputs.size() - 1; i++) {
-					if ((time >= sampler.inputs[i]) && (time <= sampler.inputs[i + 1])) {
-						float u = std::max(0.0f, time - sampler.inputs[i]) / (sampler.inputs[i + 1] - sampler.inputs[i]);
-						if (u <= 1.0f) {
-							switch (channel.path) {
-							case vkglTF::AnimationChannel::PathType::TRANSLATION: {
-								glm::vec4 trans = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], u);
-								channel.node->translation = glm::vec3(trans);
-								break;
-							}
-							case vkglTF::AnimationChannel::PathType::SCALE: {
-								glm::vec4 trans = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], u);
-								channel.node->scale = glm::vec3(trans);
-								break;
-							}
-							case vkglTF::AnimationChannel::PathType::ROTATION: {
-								glm::quat q1;
-								q1.x = sampler.outputsVec4[i].x;
-								q1.y = sampler.outputsVec4[i].y;
-								q1.z = sampler.outputsVec4[i].z;
-								q1.w = sampler.outputsVec4[i].w;
-								glm::quat q2;
-								q2.x = sampler.outputsVec4[i + 1].x;
-								q2.y = sampler.outputsVec4[i + 1].y;
-								q2.z = sampler.outputsVec4[i + 1].z;
-								q2.w = sampler.outputsVec4[i + 1].w;
-								channel.node->rotation = glm::normalize(glm::slerp(q1, q2, u));
-								break;
-							}
-							}
-							updated = true;
+		/*
+			Re-evaluate joint palettes, one skin per job, either all of them or those with a joint moved by the last update
+		*/
+		void updateSkins(bool all)
+		{
+			skinUpdated.assign(skins.size(), 0);
+			auto evaluate = [&](size_t index) {
+				const Skin &skin = skins[index];
+				bool moved = all;
+				for (uint32_t i = skin.jointOffset; i < skin.jointOffset + skin.jointCount && !moved; i++) {
+					moved = hierarchy.wasUpdated(joints[i]);
+				}
+				if (moved) {
+					updateSkin(skin);
+					skinUpdated[index] = 1;
+				}
+			};
+			if (updatePool) {
+				updatePool->parallelFor(skins.size(), evaluate);
+			} else {
+				for (size_t i = 0; i < skins.size(); i++) {
+					evaluate(i);
+				}
+			}
+			if (std::find(skinUpdated.begin(), skinUpdated.end(), 1) != skinUpdated.end()) {
+				poseVersion++;
+			}
+		}
+
+		/*
+			Recompute all world matrices in one linear pass, then update the mesh uniform buffers from them
+		*/
+		void updateNodes()
+		{
+			hierarchy.update(updatePool, [this](uint32_t first, uint32_t last) { updateMeshes(first, last); });
+			updateSkins(true);
+			cullingBoundsDirty = true;
+		}
+
+		/*
+			Propagate transforms only below nodes marked dirty in the hierarchy and re-upload the affected meshes
+			Skin palettes are re-evaluated when any of their joints moved
+		*/
+		void updateDirtyNodes()
+		{
+			const std::vector<std::pair<uint32_t, uint32_t> > &ranges = hierarchy.updateDirty(updatePool, [this](uint32_t first, uint32_t last) { updateMeshes(first, last); });
+			if (ranges.empty()) {
+				return;
+			}
+			updateSkins(false);
+			cullingBoundsDirty = true;
+		}
+
+		/*
+			Sample an animation at each of the given times into poseCache
+			Times are mapped onto the clip first (see Animation::clipTime), so every channel is written in every frame and
+			a frame's pose only depends on its time, not on the frames sampled before it
+			Frames are split into contiguous chunks, one per thread, each sampling with its own copy of the hierarchy and
+			animation state, so keyframe cursors still advance incrementally within a chunk and the model is left untouched
+			Within a chunk only meshes and skins moved since the previous frame are re-evaluated
+		*/
+		void bakePoses(uint32_t index, const std::vector<float> &times)
+		{
+			poseCache.clear();
+			if (index >= static_cast<uint32_t>(animations.size()) || times.empty()) {
+				return;
+			}
+			findAnimatedSet(animations[index]);
+			const size_t meshCount = poseCache.meshes.size();
+			const size_t jointCount = poseCache.jointCount;
+			const size_t weightCount = poseCache.weightCount;
+			poseCache.frameCount = static_cast<uint32_t>(times.size());
+			poseCache.nodeBlocks.resize(times.size() * meshCount);
+			poseCache.jointMatrices.resize(times.size() * jointCount);
+			poseCache.morphWeights.resize(times.size() * weightCount);
+			std::vector<uint32_t> meshNodes(meshes.size());
+			for (uint32_t i = 0; i < linearNodes.size(); i++) {
+				if (linearNodes[i].mesh > -1) {
+					meshNodes[linearNodes[i].mesh] = i;
+				}
+			}
+
+			const size_t chunkCount = std::min(times.size(), updatePool ? updatePool->size() + 1 : 1);
+			auto bakeChunk = [&](size_t chunk) {
+				const size_t first = times.size() * chunk / chunkCount;
+				const size_t last = times.size() * (chunk + 1) / chunkCount;
+				TransformHierarchy pose = hierarchy;
+				MorphWeights weights = morphWeights;
+				Animation animation = animations[index];
+				for (size_t frame = first; frame < last; frame++) {
+					NodeBlock *blocks = poseCache.nodeBlocks.data() + frame * meshCount;
+					glm::mat4 *jointMatrices = poseCache.jointMatrices.data() + frame * jointCount;
+					animation.evaluate(animation.clipTime(times[frame]), pose, nullptr, &weights);
+					float *frameWeights = poseCache.morphWeights.data() + frame * weightCount;
+					for (uint32_t node : poseCache.weightNodes) {
+						const float *values = &weights.values[weights.offsets[node]];
+						frameWeights = std::copy(values, values + weights.counts[node], frameWeights);
+					}
+					const bool full = frame == first;
+					if (!full) {
+						std::copy(blocks - meshCount, blocks, blocks);
+						std::copy(jointMatrices - jointCount, jointMatrices, jointMatrices);
+					}
+					pose.updateDirty();
+					for (size_t i = 0; i < meshCount; i++) {
+						const uint32_t node = meshNodes[poseCache.meshes[i]];
+						if (full || pose.wasUpdated(node)) {
+							blocks[i] = meshBlock(pose, node);
+						}
+					}
+					glm::mat4 *palette = jointMatrices;
+					for (uint32_t s : poseCache.skins) {
+						const Skin &skin = skins[s];
+						bool moved = full;
+						for (uint32_t i = skin.jointOffset; i < skin.jointOffset + skin.jointCount && !moved; i++) {
+							moved = pose.wasUpdated(joints[i]);
+						}
+						if (moved) {
+							evaluateSkin(pose, skin, palette);
 						}
+						palette += skin.jointCount;
 					}
 				}
+			};
+			if (updatePool) {
+				updatePool->parallelFor(chunkCount, bakeChunk);
+			} else {
+				bakeChunk(0);
+			}
+		}
+
+		/*
+			Find the part of the model an animation moves, see PoseCache
+			Nodes below a node with a transform channel move with it, the hierarchy stores parents before their children
+		*/
+		void findAnimatedSet(const Animation &animation)
+		{
+			std::vector<uint8_t> animated(linearNodes.size(), 0);
+			std::vector<uint8_t> weighted(linearNodes.size(), 0);
+			for (const AnimationChannel &channel : animation.channels) {
+				if (channel.node >= linearNodes.size()) {
+					continue;
+				}
+				if (channel.path == AnimationChannel::WEIGHTS) {
+					weighted[channel.node] = channel.node < morphWeights.counts.size() && morphWeights.counts[channel.node] > 0;
+				} else {
+					animated[channel.node] = 1;
+				}
 			}
-			if (updated) {
-				for (auto &node : nodes) {
-					node->update();
+			for (uint32_t i = 0; i < linearNodes.size(); i++) {
+				if (!animated[i] && hierarchy.parents[i] > -1 && animated[hierarchy.parents[i]]) {
+					animated[i] = 1;
+				}
+				if (animated[i] && linearNodes[i].mesh > -1) {
+					poseCache.meshes.push_back(static_cast<uint32_t>(linearNodes[i].mesh));
+				}
+				if (weighted[i]) {
+					poseCache.weightNodes.push_back(i);
+					poseCache.weightCount += morphWeights.counts[i];
+				}
+			}
+			for (uint32_t s = 0; s < skins.size(); s++) {
+				const Skin &skin = skins[s];
+				for (uint32_t i = skin.jointOffset; i < skin.jointOffset + skin.jointCount; i++) {
+					if (animated[joints[i]]) {
+						poseCache.skins.push_back(s);
+						poseCache.jointCount += skin.jointCount;
+						break;
+					}
 				}
 			}
 		}
 
 		/*
-			Helper functions
+			Copy a pre-baked pose into the node, joint and morph weight buffers, the only per frame work for baked
+			animations. Only the animated set is written, the rest of the buffers never changes while the pose is applied
 		*/
-		Node* findNode(Node *parent, uint32_t index) {
-			Node* nodeFound = nullptr;
-			if (parent->index == index) {
-				return parent;
-			}
-			for (auto& child : parent->children) {
-				nodeFound = findNode(child, index);
-				if (nodeFound) {
-					break;
+		void applyPose(uint32_t frame)
+		{
+			if (frame >= poseCache.frameCount || frame == poseCache.appliedFrame) {
+				return;
+			}
+			const NodeBlock *blocks = poseCache.frameBlocks(frame);
+			for (size_t i = 0; i < poseCache.meshes.size(); i++) {
+				const uint32_t mesh = poseCache.meshes[i];
+				memcpy(static_cast<char*>(nodeBuffer.mapped) + nodeBlockOffset(mesh), &blocks[i], sizeof(NodeBlock));
+				meshMatrices[mesh] = blocks[i].matrix;
+			}
+			if (!poseCache.meshes.empty()) {
+				cullingBoundsDirty = true;
+			}
+			const glm::mat4 *palette = poseCache.jointMatrices.data() + frame * poseCache.jointCount;
+			for (uint32_t s : poseCache.skins) {
+				const Skin &skin = skins[s];
+				memcpy(static_cast<glm::mat4*>(jointBuffer.mapped) + skin.jointOffset, palette, skin.jointCount * sizeof(glm::mat4));
+				palette += skin.jointCount;
+			}
+			const float *weights = poseCache.morphWeights.data() + frame * poseCache.weightCount;
+			for (uint32_t node : poseCache.weightNodes) {
+				memcpy(static_cast<float*>(morphWeightBuffer.mapped) + morphWeights.offsets[node], weights, morphWeights.counts[node] * sizeof(float));
+				weights += morphWeights.counts[node];
+			}
+			if (poseCache.jointCount > 0 || poseCache.weightCount > 0) {
+				poseVersion++;
+			}
+			poseCache.appliedFrame = frame;
+		}
+
+		/*
+			Flatten the primitives of all mesh nodes into drawList
+			Opaque and masked draws are sorted by material, then mesh, so consecutive draws share as much state as possible
+			Blended draws keep the node order, as their result depends on it
+		*/
+		void buildDrawList()
+		{
+			drawList.clear();
+			for (const Node &node : linearNodes) {
+				if (node.mesh < 0) {
+					continue;
+				}
+				const Mesh &mesh = meshes[node.mesh];
+				for (uint32_t i = mesh.firstPrimitive; i < mesh.firstPrimitive + mesh.primitiveCount; i++) {
+					const Material &material = primitives[i].material;
+					drawList.push_back({ material.alphaMode, static_cast<uint32_t>(&material - materials.data()), static_cast<uint32_t>(node.mesh), i });
 				}
 			}
-			return nodeFound;
+			// Draws of one shader permutation are kept together, so permutation pipelines are bound once per bucket
+			std::stable_sort(drawList.begin(), drawList.end(), [this](const DrawCommand &a, const DrawCommand &b) {
+				if (a.alphaMode != b.alphaMode) {
+					return a.alphaMode < b.alphaMode;
+				}
+				if (a.alphaMode == Material::ALPHAMODE_BLEND) {
+					return false;
+				}
+				if (materials[a.material].permutation != materials[b.material].permutation) {
+					return materials[a.material].permutation < materials[b.material].permutation;
+				}
+				return a.material != b.material ? a.material < b.material : a.mesh < b.mesh;
+			});
 		}
 
-		Node* nodeFromIndex(uint32_t index) {
-			Node* nodeFound = nullptr;
-			for (auto &node : nodes) {
-				nodeFound = findNode(node, index);
-				if (nodeFound) {
+		/*
+			Fill the indirect draw command and draw data buffers from drawList and group the draws into drawBatches
+			Non-indexed primitives get their own batches, they are drawn directly with the same firstInstance
+		*/
+		void createDrawBuffers()
+		{
+			const size_t drawCount = std::max<size_t>(drawList.size(), 1);
+			createHostBuffer(drawCommandBuffer, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, drawCount * sizeof(VkDrawIndexedIndirectCommand), VK_WHOLE_SIZE);
+			createHostBuffer(drawDataBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, drawCount * sizeof(DrawData), VK_WHOLE_SIZE);
+			createHostBuffer(drawCullBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, drawCount * sizeof(DrawCullData), VK_WHOLE_SIZE);
+			fillDrawBuffers();
+		}
+
+		// Write the commands, per draw data, batches and culling bounds of drawList, which fits the draw buffers
+		void fillDrawBuffers()
+		{
+			// Skinned meshes move away from their bind pose bounds
+			std::vector<bool> skinnedMeshes(meshes.size(), false);
+			for (const Node &node : linearNodes) {
+				if (node.mesh > -1 && node.skin > -1) {
+					skinnedMeshes[node.mesh] = true;
+				}
+			}
+
+			VkDrawIndexedIndirectCommand *commands = static_cast<VkDrawIndexedIndirectCommand*>(drawCommandBuffer.mapped);
+			DrawData *drawData = static_cast<DrawData*>(drawDataBuffer.mapped);
+			DrawCullData *cullData = static_cast<DrawCullData*>(drawCullBuffer.mapped);
+			drawBatches.clear();
+			cullingBounds.clear();
+			for (uint32_t i = 0; i < drawList.size(); i++) {
+				const DrawCommand &draw = drawList[i];
+				const Primitive &primitive = primitives[draw.primitive];
+				commands[i] = { primitive.indexCount, 1, primitive.firstIndex, 0, i };
+				drawData[i] = { nodeBlockOffset(draw.mesh) / 16, draw.material };
+
+				if (drawBatches.empty() || drawBatches.back().alphaMode != draw.alphaMode || drawBatches.back().material != draw.material || drawBatches.back().indexed != primitive.hasIndices) {
+					drawBatches.push_back({ draw.alphaMode, draw.material, i, 0, primitive.hasIndices });
+				}
+				drawBatches.back().drawCount++;
+
+				DrawCullData &cull = cullData[i];
+				cull.min = glm::vec4(primitive.bb.min, 1.0f);
+				cull.max = glm::vec4(primitive.bb.max, 1.0f);
+				cull.batch = static_cast<uint32_t>(drawBatches.size() - 1);
+				cull.firstDraw = drawBatches.back().firstDraw;
+				cull.flags = 0;
+				const bool cullable = primitive.bb.valid && primitive.targetCount == 0 && !skinnedMeshes[draw.mesh];
+				if (cullable) {
+					cull.flags |= DrawCullData::CULL_BOUNDS;
+				}
+				cullingBounds.add(primitive.bb.min, primitive.bb.max, draw.mesh, cullable);
+				if (draw.alphaMode == Material::ALPHAMODE_BLEND) {
+					cull.flags |= DrawCullData::KEEP_ORDER;
+				}
+				cull.padding = 0;
+			}
+		}
+
+		/*
+			Remove the draws whose bit in keep is clear from drawList, keeping the order of the others
+			The draw buffers keep their size, the culling bounds and bvh are rebuilt for the remaining draws
+		*/
+		void filterDrawList(const std::vector<uint64_t> &keep)
+		{
+			std::vector<DrawCommand> kept;
+			for (uint32_t i = 0; i < drawList.size(); i++) {
+				if ((keep[i / 64] >> (i % 64) & 1) != 0) {
+					kept.push_back(drawList[i]);
+				}
+			}
+			drawList.swap(kept);
+			fillDrawBuffers();
+			cullingBounds.refresh(meshMatrices);
+			cullingBoundsDirty = false;
+			bvh.build(cullingBounds);
+		}
+
+		// Set the instance count of each indirect draw command to its bit in visible, so hidden draws draw nothing
+		void setIndirectVisibility(const std::vector<uint64_t> &visible)
+		{
+			VkDrawIndexedIndirectCommand *commands = static_cast<VkDrawIndexedIndirectCommand*>(drawCommandBuffer.mapped);
+			for (uint32_t i = 0; i < drawList.size(); i++) {
+				commands[i].instanceCount = static_cast<uint32_t>(visible[i / 64] >> (i % 64) & 1);
+			}
+		}
+
+		/*
+			Calls visit(chunk, frame, bounds, visible) for each of the given model space view projection matrices, e.g. of
+			every frame of a camera path, with the world bounds of the frame and the bitset of its visible draws
+			Frames are split into pathChunkCount(frameCount) contiguous chunks over updatePool like bakePoses. Each chunk
+			tests the bvh of its own copy of the culling bounds, refit to every frame's pose if poses were baked for the
+			same frames
+		*/
+		size_t pathChunkCount(size_t frameCount) const
+		{
+			return std::min(frameCount, updatePool ? updatePool->size() + 1 : 1);
+		}
+
+		template<typename Visit>
+		void visitPathFrames(const std::vector<glm::mat4> &viewProjections, Visit visit)
+		{
+			refreshBounds();
+			const size_t frameCount = viewProjections.size();
+			const bool posed = poseCache.frameCount == frameCount;
+			const size_t chunkCount = pathChunkCount(frameCount);
+			auto cullChunk = [&](size_t chunk) {
+				const size_t first = frameCount * chunk / chunkCount;
+				const size_t last = frameCount * (chunk + 1) / chunkCount;
+				CullingBounds bounds = cullingBounds;
+				BoundingVolumeHierarchy tree = bvh;
+				std::vector<glm::mat4> matrices = meshMatrices;
+				std::vector<uint64_t> visible;
+				for (size_t frame = first; frame < last; frame++) {
+					if (posed) {
+						const NodeBlock *blocks = poseCache.frameBlocks(static_cast<uint32_t>(frame));
+						for (size_t i = 0; i < poseCache.meshes.size(); i++) {
+							matrices[poseCache.meshes[i]] = blocks[i].matrix;
+						}
+						bounds.refresh(matrices);
+						tree.refit(bounds);
+					}
+					// Draws without usable bounds are always visible
+					visible = bounds.alwaysVisible;
+					tree.query(bounds, Frustum(viewProjections[frame]), [&](uint32_t index) {
+						visible[index / 64] |= uint64_t(1) << (index % 64);
+					});
+					visit(chunk, frame, static_cast<const CullingBounds&>(bounds), static_cast<const std::vector<uint64_t>&>(visible));
+				}
+			};
+			if (chunkCount == 0) {
+				return;
+			}
+			if (updatePool) {
+				updatePool->parallelFor(chunkCount, cullChunk);
+			} else {
+				cullChunk(0);
+			}
+		}
+
+		// Visible draws for each of the given model space view projection matrices, see visitPathFrames
+		void computeVisibility(const std::vector<glm::mat4> &viewProjections, PathVisibility &visibility)
+		{
+			visibility.clear();
+			if (viewProjections.empty()) {
+				return;
+			}
+			const uint32_t drawCount = static_cast<uint32_t>(drawList.size());
+			std::vector<std::vector<uint32_t> > frames(viewProjections.size());
+			visitPathFrames(viewProjections, [&](size_t, size_t frame, const CullingBounds &, const std::vector<uint64_t> &visible) {
+				PathVisibility::encode(visible, drawCount, frames[frame]);
+			});
+			visibility.assign(frames, drawCount);
+		}
+
+		/*
+			Mip levels each texture can skip while still covering every frame of a camera path, see uploadTextures
+			A draw needs the most texels in the frame it is visible and closest to the camera. pixelScale is the
+			projection's pixels per world unit at distance 1 (half the viewport height times projection[1][1]), which
+			with the primitive's texel density gives the texture resolution needed per UV set. Textures no visible draw
+			uses keep only their last level. With a budget in bytes, the largest textures then drop further levels
+			until all fit
+		*/
+		std::vector<uint32_t> planTextureResidency(const std::vector<glm::mat4> &viewProjections, float pixelScale, VkDeviceSize budget = 0)
+		{
+			const uint32_t drawCount = static_cast<uint32_t>(drawList.size());
+			std::vector<std::vector<float> > closest(pathChunkCount(viewProjections.size()), std::vector<float>(drawCount, FLT_MAX));
+			visitPathFrames(viewProjections, [&](size_t chunk, size_t frame, const CullingBounds &bounds, const std::vector<uint64_t> &visible) {
+				// The camera is the point projected to infinity, clip space (0, 0, w, 0)
+				const glm::vec4 eye = glm::inverse(viewProjections[frame]) * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+				const glm::vec3 position = glm::vec3(eye) / eye.w;
+				std::vector<float> &distances = closest[chunk];
+				for (uint32_t i = 0; i < drawCount; i++) {
+					if (!PathVisibility::bit(visible, i)) {
+						continue;
+					}
+					if (PathVisibility::bit(bounds.alwaysVisible, i)) {
+						distances[i] = 0.0f;
+						continue;
+					}
+					const glm::vec3 min = BoundingVolumeHierarchy::boxMin(bounds, i);
+					const glm::vec3 max = BoundingVolumeHierarchy::boxMax(bounds, i);
+					distances[i] = std::min(distances[i], glm::length(position - glm::clamp(position, min, max)));
+				}
+			});
+
+			// Highest screen pixels per texture coordinate unit of every texture
+			std::vector<float> demand(textures.size(), 0.0f);
+			for (uint32_t i = 0; i < drawCount; i++) {
+				float distance = FLT_MAX;
+				for (const std::vector<float> &distances : closest) {
+					distance = std::min(distance, distances[i]);
+				}
+				if (distance == FLT_MAX) {
+					continue;
+				}
+				const DrawCommand &draw = drawList[i];
+				const Primitive &primitive = primitives[draw.primitive];
+				const glm::mat4 &matrix = meshMatrices[draw.mesh];
+				const float scale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+				const float pixelsPerUnit = pixelScale * scale / std::max(distance, 1e-4f);
+				const Material &material = materials[draw.material];
+				const std::pair<const Texture*, uint8_t> slots[] = {
+					std::make_pair(material.baseColorTexture, material.texCoordSets.baseColor),
+					std::make_pair(material.metallicRoughnessTexture, material.texCoordSets.metallicRoughness),
+					std::make_pair(material.normalTexture, material.texCoordSets.normal),
+					std::make_pair(material.occlusionTexture, material.texCoordSets.occlusion),
+					std::make_pair(material.emissiveTexture, material.texCoordSets.emissive),
+					std::make_pair(material.extension.specularGlossinessTexture, material.texCoordSets.specularGlossiness),
+					std::make_pair(material.extension.diffuseTexture, material.texCoordSets.baseColor)
+				};
+				for (const std::pair<const Texture*, uint8_t> &slot : slots) {
+					if (slot.first) {
+						float &textureDemand = demand[slot.first - textures.data()];
+						textureDemand = std::max(textureDemand, pixelsPerUnit * primitive.worldPerUV[std::min<uint8_t>(slot.second, 1)]);
+					}
+				}
+			}
+
+			std::vector<uint32_t> skipLevels(textures.size());
+			VkDeviceSize total = 0;
+			for (size_t i = 0; i < textures.size(); i++) {
+				const Texture &texture = textures[i];
+				const float size = static_cast<float>(std::max(texture.width, texture.height));
+				const float level = demand[i] > 0.0f ? std::floor(std::log2(std::max(size / demand[i], 1.0f))) : FLT_MAX;
+				skipLevels[i] = static_cast<uint32_t>(std::min(level, static_cast<float>(texture.mipLevels - 1)));
+				total += Texture::residentSize(texture.width, texture.height, skipLevels[i]);
+			}
+			while (budget > 0 && total > budget) {
+				size_t largest = textures.size();
+				VkDeviceSize largestSize = 0;
+				for (size_t i = 0; i < textures.size(); i++) {
+					const VkDeviceSize size = Texture::residentSize(textures[i].width, textures[i].height, skipLevels[i]);
+					if (skipLevels[i] + 1 < textures[i].mipLevels && size > largestSize) {
+						largest = i;
+						largestSize = size;
+					}
+				}
+				if (largest == textures.size()) {
 					break;
 				}
+				skipLevels[largest]++;
+				total -= largestSize - Texture::residentSize(textures[largest].width, textures[largest].height, skipLevels[largest]);
+			}
+			return skipLevels;
+		}
+
+		/*
+			Test the bounds of all draws against a frustum in model space on the CPU, see CullingBounds::isVisible
+			World bounds are only recomputed if node transforms changed since the last call
+		*/
+		void cullDraws(const Frustum &frustum)
+		{
+			refreshBounds();
+			cullingBounds.cull(frustum);
+		}
+
+		// Recompute the world bounds of all draws and refit bvh to them if node transforms changed
+		void refreshBounds()
+		{
+			if (cullingBoundsDirty) {
+				cullingBounds.refresh(meshMatrices);
+				bvh.refit(cullingBounds);
+				cullingBoundsDirty = false;
 			}
-			return nodeFound;
+		}
+
+		/*
+			Index in drawList of the closest draw whose world bounds are hit by a ray in model space, -1 if none is hit
+			Tests bounds only, skinned and morphed draws use their bind pose bounds
+		*/
+		int32_t pickDraw(const glm::vec3 &origin, const glm::vec3 &direction)
+		{
+			refreshBounds();
+			float distance;
+			return bvh.raycast(cullingBounds, origin, direction, distance);
+		}
+
+		/*
+			Helper functions
+		*/
+		// Index of the node loaded from the given glTF node in linearNodes, -1 if not part of the scene
+		int32_t nodeFromIndex(uint32_t index) const {
+			return index < nodeLookup.size() ? nodeLookup[index] : -1;
 		}
 	};
 }
@@ -0,0 +1,550 @@
+/*
+* glTF animation data and batched animation evaluation
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <tuple>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "transformhierarchy.hpp"
+#include "keyframes.hpp"
+
+// SSE is part of every x86-64 target, other platforms use the scalar kernels
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define VKGLTF_ANIMATION_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace vkglTF
+{
+	/*
+		glTF animation channel
+	*/
+	struct AnimationChannel {
+		enum PathType { TRANSLATION, ROTATION, SCALE, WEIGHTS };
+		PathType path;
+		uint32_t node;
+		uint32_t samplerIndex;
+	};
+
+	/*
+		glTF animation sampler
+	*/
+	struct AnimationSampler {
+		enum InterpolationType { LINEAR, STEP, CUBICSPLINE };
+		InterpolationType interpolation;
+		std::vector<float> inputs;
+		// CUBICSPLINE samplers store an in-tangent, the value and an out-tangent per keyframe
+		std::vector<glm::vec4> outputsVec4;
+		// Scalar outputs of morph target weight samplers, one value per target and keyframe
+		std::vector<float> outputs;
+		// Keyframe segment of the last evaluation, see findKeyframe
+		uint32_t cursor = 0;
+
+		uint32_t outputStride() const
+		{
+			return interpolation == CUBICSPLINE ? 3 : 1;
+		}
+	};
+
+	/*
+		Morph target weights of all nodes in one array, node i owns values [offsets[i], offsets[i] + counts[i])
+	*/
+	struct MorphWeights {
+		std::vector<float> values;
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> counts;
+		// Set whenever an animation writes weights, to be reset by whoever uploads them
+		bool changed = false;
+	};
+
+	/*
+		Interpolation kernels over rows of keyframe values, one row per vector component holding that component of all
+		channels of a group. The factor is the same for the whole row, so each kernel is a few multiply-adds over
+		contiguous floats, processed four channels at a time with SSE where available
+	*/
+	namespace kernels
+	{
+		// result = a + (b - a) * u
+		inline void lerp(uint32_t count, const float *a, const float *b, float u, float *result)
+		{
+			uint32_t i = 0;
+#if defined(VKGLTF_ANIMATION_SSE)
+			const __m128 factor = _mm_set1_ps(u);
+			for (; i + 4 <= count; i += 4) {
+				const __m128 va = _mm_loadu_ps(a + i);
+				_mm_storeu_ps(result + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b + i), va), factor)));
+			}
+#endif
+			for (; i < count; i++) {
+				result[i] = a[i] + (b[i] - a[i]) * u;
+			}
+		}
+
+		// result = h[0] * p0 + h[1] * m0 + h[2] * p1 + h[3] * m1, with the Hermite basis (and tangent scale) in h
+		inline void hermite(uint32_t count, const float *p0, const float *m0, const float *p1, const float *m1, const float h[4], float *result)
+		{
+			uint32_t i = 0;
+#if defined(VKGLTF_ANIMATION_SSE)
+			const __m128 h0 = _mm_set1_ps(h[0]);
+			const __m128 h1 = _mm_set1_ps(h[1]);
+			const __m128 h2 = _mm_set1_ps(h[2]);
+			const __m128 h3 = _mm_set1_ps(h[3]);
+			for (; i + 4 <= count; i += 4) {
+				const __m128 r0 = _mm_add_ps(_mm_mul_ps(h0, _mm_loadu_ps(p0 + i)), _mm_mul_ps(h1, _mm_loadu_ps(m0 + i)));
+				const __m128 r1 = _mm_add_ps(_mm_mul_ps(h2, _mm_loadu_ps(p1 + i)), _mm_mul_ps(h3, _mm_loadu_ps(m1 + i)));
+				_mm_storeu_ps(result + i, _mm_add_ps(r0, r1));
+			}
+#endif
+			for (; i < count; i++) {
+				result[i] = h[0] * p0[i] + h[1] * m0[i] + h[2] * p1[i] + h[3] * m1[i];
+			}
+		}
+
+		// Normalize the four component vectors stored in the rows v, zero length vectors become zero
+		inline void normalize4(uint32_t count, float *const v[4])
+		{
+			uint32_t i = 0;
+#if defined(VKGLTF_ANIMATION_SSE)
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			for (; i + 4 <= count; i += 4) {
+				const __m128 x = _mm_loadu_ps(v[0] + i);
+				const __m128 y = _mm_loadu_ps(v[1] + i);
+				const __m128 z = _mm_loadu_ps(v[2] + i);
+				const __m128 w = _mm_loadu_ps(v[3] + i);
+				const __m128 squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+				const __m128 length = _mm_sqrt_ps(squared);
+				const __m128 scale = _mm_and_ps(_mm_cmpgt_ps(length, zero), _mm_div_ps(one, length));
+				_mm_storeu_ps(v[0] + i, _mm_mul_ps(x, scale));
+				_mm_storeu_ps(v[1] + i, _mm_mul_ps(y, scale));
+				_mm_storeu_ps(v[2] + i, _mm_mul_ps(z, scale));
+				_mm_storeu_ps(v[3] + i, _mm_mul_ps(w, scale));
+			}
+#endif
+			for (; i < count; i++) {
+				const float length = std::sqrt(v[0][i] * v[0][i] + v[1][i] * v[1][i] + v[2][i] * v[2][i] + v[3][i] * v[3][i]);
+				const float scale = length > 0.0f ? 1.0f / length : 0.0f;
+				for (uint32_t c = 0; c < 4; c++) {
+					v[c][i] *= scale;
+				}
+			}
+		}
+
+		// Weights of the first value, first out-tangent, second value and second in-tangent of a cubic spline segment
+		inline void hermiteBasis(float u, float duration, float h[4])
+		{
+			const float u2 = u * u;
+			const float u3 = u2 * u;
+			h[0] = 2.0f * u3 - 3.0f * u2 + 1.0f;
+			h[1] = (u3 - 2.0f * u2 + u) * duration;
+			h[2] = -2.0f * u3 + 3.0f * u2;
+			h[3] = (u3 - u2) * duration;
+		}
+	}
+
+	/*
+		Keyframe times shared by the samplers of a channel group, located once per evaluation
+	*/
+	struct Timeline {
+		std::vector<float> times;
+		uint32_t cursor = 0;
+		// Segment of the last evaluation: its first and last key, the interpolation factor and the segment duration
+		uint32_t first = 0;
+		uint32_t next = 0;
+		float factor = 0.0f;
+		float duration = 0.0f;
+
+		void locate(float time)
+		{
+			if (!findKeyframe(times, time, cursor)) {
+				return;
+			}
+			first = cursor;
+			next = nextKeyframe(times, first);
+			factor = keyframeFactor(times, time, first);
+			duration = times[next] - times[first];
+		}
+	};
+
+	/*
+		Channels sharing path type, interpolation and keyframe times, evaluated together
+		Keyframe values are stored transposed: for each key and output of a key (in-tangent, value and out-tangent for
+		cubic splines) one row per vector component, holding that component for all channels of the group. Once the
+		timeline is located the kernels run over two contiguous rows per component, instead of gathering the keys
+		of every channel from its own sampler
+	*/
+	struct ChannelGroup {
+		AnimationChannel::PathType path;
+		AnimationSampler::InterpolationType interpolation;
+		uint32_t timeline;
+		std::vector<uint32_t> nodes;
+		std::vector<float> keys;
+
+		uint32_t components() const
+		{
+			return path == AnimationChannel::ROTATION ? 4 : 3;
+		}
+
+		uint32_t outputCount() const
+		{
+			return interpolation == AnimationSampler::CUBICSPLINE ? 3 : 1;
+		}
+
+		float *row(uint32_t key, uint32_t output, uint32_t component)
+		{
+			return &keys[((key * outputCount() + output) * components() + component) * nodes.size()];
+		}
+	};
+
+	/*
+		glTF animation
+	*/
+	struct Animation {
+		std::string name;
+		std::vector<AnimationSampler> samplers;
+		std::vector<AnimationChannel> channels;
+		float start = std::numeric_limits<float>::max();
+		float end = std::numeric_limits<float>::min();
+
+		std::vector<Timeline> timelines;
+		std::vector<ChannelGroup> groups;
+		// Groups of fewer channels would not fill a SIMD register, their channels are evaluated one at a time instead
+		static const uint32_t minGroupSize = 4;
+		std::vector<uint32_t> singleChannels;
+		// Channel ranges evaluated as one job: group (singleGroup for ranges of singleChannels), first and last channel
+		struct Batch {
+			uint32_t group;
+			uint32_t first;
+			uint32_t last;
+		};
+		std::vector<Batch> batches;
+		static const uint32_t batchSize = 256;
+		static const uint32_t singleGroup = ~0u;
+		// Morph target weight channels, few per animation and evaluated one at a time
+		std::vector<uint32_t> weightChannels;
+
+		// Time on the clip for a playback time, looping over [start, end] like continuous playback does
+		float clipTime(float time) const
+		{
+			const float duration = end - start;
+			if (!(duration > 0.0f)) {
+				return start <= end ? start : time;
+			}
+			const float offset = std::fmod(time - start, duration);
+			return start + (offset < 0.0f ? offset + duration : offset);
+		}
+
+		/*
+			Group the channels by path, interpolation and keyframe times and transpose their keys, has to be called once
+			after loading. Exporters commonly write one time accessor per clip, or per channel with the same content, so
+			samplers are matched by their times rather than their accessors
+			Linear and step rotation keys are normalized and flipped onto the hemisphere of their predecessor, so the
+			linear kernel interpolates along the shorter arc without testing each segment
+		*/
+		void compile()
+		{
+			timelines.clear();
+			groups.clear();
+			singleChannels.clear();
+			batches.clear();
+			weightChannels.clear();
+			std::map<std::vector<float>, uint32_t> timeIndices;
+			std::map<std::tuple<int, int, uint32_t>, std::vector<uint32_t>> groupChannels;
+			for (uint32_t i = 0; i < channels.size(); i++) {
+				const AnimationChannel &channel = channels[i];
+				if (channel.path == AnimationChannel::WEIGHTS) {
+					weightChannels.push_back(i);
+					continue;
+				}
+				const AnimationSampler &sampler = samplers[channel.samplerIndex];
+				if (sampler.inputs.empty() || sampler.outputsVec4.size() < sampler.inputs.size() * sampler.outputStride()) {
+					continue;
+				}
+				const uint32_t times = timeIndices.insert(std::make_pair(sampler.inputs, static_cast<uint32_t>(timeIndices.size()))).first->second;
+				groupChannels[std::make_tuple(static_cast<int>(channel.path), static_cast<int>(sampler.interpolation), times)].push_back(i);
+			}
+
+			const uint32_t unused = ~0u;
+			std::vector<uint32_t> timelineIndices(timeIndices.size(), unused);
+			for (const auto &entry : groupChannels) {
+				const std::vector<uint32_t> &members = entry.second;
+				if (members.size() < minGroupSize) {
+					singleChannels.insert(singleChannels.end(), members.begin(), members.end());
+					continue;
+				}
+				const AnimationSampler &first = samplers[channels[members[0]].samplerIndex];
+				uint32_t &timeline = timelineIndices[std::get<2>(entry.first)];
+				if (timeline == unused) {
+					timeline = static_cast<uint32_t>(timelines.size());
+					timelines.push_back(Timeline());
+					timelines.back().times = first.inputs;
+				}
+
+				groups.push_back(ChannelGroup());
+				ChannelGroup &group = groups.back();
+				group.path = channels[members[0]].path;
+				group.interpolation = first.interpolation;
+				group.timeline = timeline;
+				const uint32_t count = static_cast<uint32_t>(members.size());
+				const uint32_t keyCount = static_cast<uint32_t>(first.inputs.size());
+				const uint32_t outputCount = group.outputCount();
+				const uint32_t components = group.components();
+				const bool alignRotations = group.path == AnimationChannel::ROTATION && group.interpolation != AnimationSampler::CUBICSPLINE;
+				for (uint32_t channel : members) {
+					group.nodes.push_back(channels[channel].node);
+				}
+				group.keys.resize(keyCount * outputCount * components * count);
+				for (uint32_t i = 0; i < count; i++) {
+					const AnimationSampler &sampler = samplers[channels[members[i]].samplerIndex];
+					glm::vec4 previous(0.0f);
+					for (uint32_t k = 0; k < keyCount; k++) {
+						for (uint32_t o = 0; o < outputCount; o++) {
+							glm::vec4 value = sampler.outputsVec4[k * outputCount + o];
+							if (alignRotations) {
+								const float length = glm::length(value);
+								value = length > 0.0f ? value / length : value;
+								if (k > 0 && glm::dot(previous, value) < 0.0f) {
+									value = -value;
+								}
+								previous = value;
+							}
+							for (uint32_t c = 0; c < components; c++) {
+								group.row(k, o, c)[i] = value[c];
+							}
+						}
+					}
+				}
+				const uint32_t g = static_cast<uint32_t>(groups.size() - 1);
+				for (uint32_t first = 0; first < count; first += batchSize) {
+					batches.push_back({ g, first, std::min(first + batchSize, count) });
+				}
+			}
+
+			std::sort(singleChannels.begin(), singleChannels.end());
+			const uint32_t singleCount = static_cast<uint32_t>(singleChannels.size());
+			for (uint32_t first = 0; first < singleCount; first += batchSize) {
+				batches.push_back({ singleGroup, first, std::min(first + batchSize, singleCount) });
+			}
+		}
+
+		// Sample a channel that is not part of a group straight from its sampler
+		void evaluateChannel(const AnimationChannel &channel, float time, TransformHierarchy &hierarchy)
+		{
+			AnimationSampler &sampler = samplers[channel.samplerIndex];
+			if (!findKeyframe(sampler.inputs, time, sampler.cursor)) {
+				return;
+			}
+			const uint32_t segment = sampler.cursor;
+			const uint32_t next = nextKeyframe(sampler.inputs, segment);
+			const float u = keyframeFactor(sampler.inputs, time, segment);
+			const glm::vec4 *outputs = sampler.outputsVec4.data();
+			glm::vec4 value;
+			switch (sampler.interpolation) {
+			case AnimationSampler::STEP:
+				value = outputs[u >= 1.0f ? next : segment];
+				break;
+			case AnimationSampler::LINEAR: {
+				const glm::vec4 a = outputs[segment];
+				glm::vec4 b = outputs[next];
+				// Interpolate rotations along the shorter arc
+				if (channel.path == AnimationChannel::ROTATION && glm::dot(a, b) < 0.0f) {
+					b = -b;
+				}
+				value = a + (b - a) * u;
+				break;
+			}
+			case AnimationSampler::CUBICSPLINE: {
+				// Keys are stored as in-tangent, value and out-tangent, tangents are scaled by the segment duration
+				float h[4];
+				kernels::hermiteBasis(u, sampler.inputs[next] - sampler.inputs[segment], h);
+				value = outputs[segment * 3 + 1] * h[0] + outputs[segment * 3 + 2] * h[1] + outputs[next * 3 + 1] * h[2] + outputs[next * 3] * h[3];
+				break;
+			}
+			}
+			switch (channel.path) {
+			case AnimationChannel::TRANSLATION:
+				hierarchy.translations[channel.node] = glm::vec3(value);
+				break;
+			case AnimationChannel::SCALE:
+				hierarchy.scales[channel.node] = glm::vec3(value);
+				break;
+			case AnimationChannel::ROTATION: {
+				const float length = glm::length(value);
+				value = length > 0.0f ? value / length : glm::vec4(0.0f);
+				hierarchy.rotations[channel.node] = glm::quat(value.w, value.x, value.y, value.z);
+				break;
+			}
+			case AnimationChannel::WEIGHTS:
+				// Not grouped, see evaluateWeights
+				break;
+			}
+		}
+
+		void evaluateBatch(const Batch &batch, float time, TransformHierarchy &hierarchy)
+		{
+			if (batch.group == singleGroup) {
+				for (uint32_t i = batch.first; i < batch.last; i++) {
+					evaluateChannel(channels[singleChannels[i]], time, hierarchy);
+				}
+				return;
+			}
+
+			ChannelGroup &group = groups[batch.group];
+			const Timeline &timeline = timelines[group.timeline];
+			const uint32_t count = batch.last - batch.first;
+			const uint32_t components = group.components();
+			const float u = timeline.factor;
+
+			float results[4][batchSize];
+			float *values[4] = {};
+			switch (group.interpolation) {
+			case AnimationSampler::STEP: {
+				// Nothing to interpolate, the results are read from the rows of the segment's first or last key
+				const uint32_t key = u >= 1.0f ? timeline.next : timeline.first;
+				for (uint32_t c = 0; c < components; c++) {
+					values[c] = group.row(key, 0, c) + batch.first;
+				}
+				break;
+			}
+			case AnimationSampler::LINEAR:
+				for (uint32_t c = 0; c < components; c++) {
+					values[c] = results[c];
+					kernels::lerp(count, group.row(timeline.first, 0, c) + batch.first, group.row(timeline.next, 0, c) + batch.first, u, values[c]);
+				}
+				break;
+			case AnimationSampler::CUBICSPLINE: {
+				// Keys are stored as in-tangent, value and out-tangent, tangents are scaled by the segment duration
+				float h[4];
+				kernels::hermiteBasis(u, timeline.duration, h);
+				for (uint32_t c = 0; c < components; c++) {
+					values[c] = results[c];
+					kernels::hermite(count, group.row(timeline.first, 1, c) + batch.first, group.row(timeline.first, 2, c) + batch.first,
+						group.row(timeline.next, 1, c) + batch.first, group.row(timeline.next, 0, c) + batch.first, h, values[c]);
+				}
+				break;
+			}
+			}
+			if (group.path == AnimationChannel::ROTATION && group.interpolation != AnimationSampler::STEP) {
+				kernels::normalize4(count, values);
+			}
+
+			// Scatter
+			const uint32_t *nodes = group.nodes.data() + batch.first;
+			for (uint32_t i = 0; i < count; i++) {
+				switch (group.path) {
+				case AnimationChannel::TRANSLATION:
+					hierarchy.translations[nodes[i]] = glm::vec3(values[0][i], values[1][i], values[2][i]);
+					break;
+				case AnimationChannel::SCALE:
+					hierarchy.scales[nodes[i]] = glm::vec3(values[0][i], values[1][i], values[2][i]);
+					break;
+				case AnimationChannel::ROTATION:
+					hierarchy.rotations[nodes[i]] = glm::quat(values[3][i], values[0][i], values[1][i], values[2][i]);
+					break;
+				case AnimationChannel::WEIGHTS:
+					// Not grouped, see evaluateWeights
+					break;
+				}
+			}
+		}
+
+		// Sample a morph target weights channel, all weights of the target node are written at once
+		bool evaluateWeights(const AnimationChannel &channel, float time, MorphWeights &weights)
+		{
+			AnimationSampler &sampler = samplers[channel.samplerIndex];
+			const uint32_t count = channel.node < weights.counts.size() ? weights.counts[channel.node] : 0;
+			const size_t keyStride = count * sampler.outputStride();
+			if (count == 0 || sampler.outputs.size() < sampler.inputs.size() * keyStride || !findKeyframe(sampler.inputs, time, sampler.cursor)) {
+				return false;
+			}
+			const uint32_t segment = sampler.cursor;
+			const uint32_t next = nextKeyframe(sampler.inputs, segment);
+			const float u = keyframeFactor(sampler.inputs, time, segment);
+			const float *k0 = &sampler.outputs[segment * keyStride];
+			const float *k1 = &sampler.outputs[next * keyStride];
+			float *result = &weights.values[weights.offsets[channel.node]];
+			switch (sampler.interpolation) {
+			case AnimationSampler::STEP:
+				for (uint32_t i = 0; i < count; i++) {
+					result[i] = u >= 1.0f ? k1[i] : k0[i];
+				}
+				break;
+			case AnimationSampler::LINEAR:
+				for (uint32_t i = 0; i < count; i++) {
+					result[i] = k0[i] + (k1[i] - k0[i]) * u;
+				}
+				break;
+			case AnimationSampler::CUBICSPLINE: {
+				// Keyframes hold the in-tangents, values and out-tangents of all targets
+				const float duration = sampler.inputs[next] - sampler.inputs[segment];
+				const float t2 = u * u;
+				const float t3 = t2 * u;
+				for (uint32_t i = 0; i < count; i++) {
+					result[i] = (2.0f * t3 - 3.0f * t2 + 1.0f) * k0[count + i] + (t3 - 2.0f * t2 + u) * k0[2 * count + i] * duration
+						+ (-2.0f * t3 + 3.0f * t2) * k1[count + i] + (t3 - t2) * k1[i] * duration;
+				}
+				break;
+			}
+			}
+			return true;
+		}
+
+		/*
+			Sample all channels at the given time into the node transforms of the hierarchy and mark the animated nodes dirty
+			Channels of one animation target distinct node properties, so batches can run on a thread pool in any order
+			Morph target weight channels are written to weights if given, which are then flagged as changed
+			Returns true if any transform channel had a value at that time
+		*/
+		bool evaluate(float time, TransformHierarchy &hierarchy, vks::ThreadPool *pool = nullptr, MorphWeights *weights = nullptr)
+		{
+			// No keyframe segment contains a time that is not a number
+			if (time != time) {
+				return false;
+			}
+			if (pool) {
+				pool->parallelFor(timelines.size(), [&](size_t i) { timelines[i].locate(time); });
+				pool->parallelFor(batches.size(), [&](size_t i) { evaluateBatch(batches[i], time, hierarchy); });
+			} else {
+				for (Timeline &timeline : timelines) {
+					timeline.locate(time);
+				}
+				for (const Batch &batch : batches) {
+					evaluateBatch(batch, time, hierarchy);
+				}
+			}
+
+			if (weights) {
+				for (uint32_t index : weightChannels) {
+					if (evaluateWeights(channels[index], time, *weights)) {
+						weights->changed = true;
+					}
+				}
+			}
+
+			for (const ChannelGroup &group : groups) {
+				for (uint32_t node : group.nodes) {
+					hierarchy.markDirty(node);
+				}
+			}
+			for (uint32_t index : singleChannels) {
+				hierarchy.markDirty(channels[index].node);
+			}
+			return !groups.empty() || !singleChannels.empty();
+		}
+	};
+}
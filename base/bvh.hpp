@@ -0,0 +1,297 @@
+/*
+* Bounding volume hierarchy over world space boxes
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <stdint.h>
+
+#include "frustumculling.hpp"
+
+namespace vkglTF
+{
+	/*
+		Binary BVH over the boxes of a CullingBounds, built with binned surface area heuristic splits
+		Nodes are stored with both children next to each other after their parent, so refit() can update all bounds
+		bottom up in one reverse pass when the boxes move without changing the tree
+	*/
+	struct BoundingVolumeHierarchy {
+		struct Node {
+			glm::vec3 min;
+			// Leaves: first entry in items, interior nodes: index of the left child, the right one follows it
+			uint32_t first;
+			glm::vec3 max;
+			// Number of items of a leaf, 0 for interior nodes
+			uint32_t count;
+		};
+
+		static const uint32_t BINS = 16;
+		uint32_t maxLeafSize = 4;
+
+		std::vector<Node> nodes;
+		// Box indices in leaf order
+		std::vector<uint32_t> items;
+
+		void clear()
+		{
+			nodes.clear();
+			items.clear();
+		}
+
+		void build(const CullingBounds &bounds)
+		{
+			clear();
+			if (bounds.count == 0) {
+				return;
+			}
+			items.resize(bounds.count);
+			for (uint32_t i = 0; i < bounds.count; i++) {
+				items[i] = i;
+			}
+			std::vector<glm::vec3> centroids(bounds.count);
+			for (uint32_t i = 0; i < bounds.count; i++) {
+				centroids[i] = 0.5f * (boxMin(bounds, i) + boxMax(bounds, i));
+			}
+
+			nodes.reserve(2 * bounds.count);
+			nodes.push_back(Node{ glm::vec3(0.0f), 0, glm::vec3(0.0f), bounds.count });
+			std::vector<uint32_t> stack(1, 0);
+			while (!stack.empty()) {
+				const uint32_t index = stack.back();
+				stack.pop_back();
+				updateLeaf(bounds, nodes[index]);
+				uint32_t split;
+				if (!findSplit(bounds, centroids, nodes[index], split)) {
+					continue;
+				}
+				const uint32_t first = nodes[index].first;
+				const uint32_t count = nodes[index].count;
+				const uint32_t left = static_cast<uint32_t>(nodes.size());
+				nodes.push_back(Node{ glm::vec3(0.0f), first, glm::vec3(0.0f), split - first });
+				nodes.push_back(Node{ glm::vec3(0.0f), split, glm::vec3(0.0f), first + count - split });
+				nodes[index].first = left;
+				nodes[index].count = 0;
+				stack.push_back(left);
+				stack.push_back(left + 1);
+			}
+		}
+
+		// Recompute all node bounds from the current boxes, keeping the tree
+		void refit(const CullingBounds &bounds)
+		{
+			for (size_t i = nodes.size(); i-- > 0;) {
+				Node &node = nodes[i];
+				if (node.count > 0) {
+					updateLeaf(bounds, node);
+				} else {
+					const Node &left = nodes[node.first];
+					const Node &right = nodes[node.first + 1];
+					node.min = glm::min(left.min, right.min);
+					node.max = glm::max(left.max, right.max);
+				}
+			}
+		}
+
+		/*
+			Calls visit(box) for every box intersecting the frustum
+			Subtrees completely inside the frustum are reported without testing their boxes
+		*/
+		template<typename Visit>
+		void query(const CullingBounds &bounds, const Frustum &frustum, Visit visit) const
+		{
+			if (nodes.empty()) {
+				return;
+			}
+			std::vector<std::pair<uint32_t, bool> > stack(1, std::make_pair(0u, false));
+			while (!stack.empty()) {
+				const uint32_t index = stack.back().first;
+				bool inside = stack.back().second;
+				stack.pop_back();
+				const Node &node = nodes[index];
+				if (!inside) {
+					const int result = frustum.classify(node.min, node.max);
+					if (result < 0) {
+						continue;
+					}
+					inside = result > 0;
+				}
+				if (node.count == 0) {
+					stack.push_back(std::make_pair(node.first, inside));
+					stack.push_back(std::make_pair(node.first + 1, inside));
+					continue;
+				}
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					if (inside || frustum.classify(boxMin(bounds, items[i]), boxMax(bounds, items[i])) >= 0) {
+						visit(items[i]);
+					}
+				}
+			}
+		}
+
+		/*
+			Closest box hit by the ray origin + t * direction with t >= 0
+			Returns the box index and its entry distance in t, or -1 if no box is hit
+		*/
+		int32_t raycast(const CullingBounds &bounds, const glm::vec3 &origin, const glm::vec3 &direction, float &t) const
+		{
+			const glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+			int32_t hit = -1;
+			t = FLT_MAX;
+			if (nodes.empty()) {
+				return hit;
+			}
+			std::vector<uint32_t> stack(1, 0);
+			while (!stack.empty()) {
+				const Node &node = nodes[stack.back()];
+				stack.pop_back();
+				float entry;
+				if (!intersectRay(node.min, node.max, origin, inverse, entry) || entry >= t) {
+					continue;
+				}
+				if (node.count == 0) {
+					stack.push_back(node.first);
+					stack.push_back(node.first + 1);
+					continue;
+				}
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					if (intersectRay(boxMin(bounds, items[i]), boxMax(bounds, items[i]), origin, inverse, entry) && entry < t) {
+						t = entry;
+						hit = static_cast<int32_t>(items[i]);
+					}
+				}
+			}
+			return hit;
+		}
+
+		static glm::vec3 boxMin(const CullingBounds &bounds, uint32_t index)
+		{
+			return glm::vec3(bounds.worldMin[0][index], bounds.worldMin[1][index], bounds.worldMin[2][index]);
+		}
+
+		static glm::vec3 boxMax(const CullingBounds &bounds, uint32_t index)
+		{
+			return glm::vec3(bounds.worldMax[0][index], bounds.worldMax[1][index], bounds.worldMax[2][index]);
+		}
+
+		static float surfaceArea(const glm::vec3 &min, const glm::vec3 &max)
+		{
+			const glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+			return size.x * size.y + size.y * size.z + size.z * size.x;
+		}
+
+		// Slab test, entry is clamped to the ray origin
+		static bool intersectRay(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &origin, const glm::vec3 &inverse, float &entry)
+		{
+			float tMin = 0.0f;
+			float tMax = FLT_MAX;
+			for (int axis = 0; axis < 3; axis++) {
+				float t0 = (min[axis] - origin[axis]) * inverse[axis];
+				float t1 = (max[axis] - origin[axis]) * inverse[axis];
+				if (t0 > t1) {
+					std::swap(t0, t1);
+				}
+				tMin = std::max(tMin, t0);
+				tMax = std::min(tMax, t1);
+			}
+			entry = tMin;
+			return tMin <= tMax;
+		}
+
+		void updateLeaf(const CullingBounds &bounds, Node &node) const
+		{
+			node.min = glm::vec3(FLT_MAX);
+			node.max = glm::vec3(-FLT_MAX);
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				node.min = glm::min(node.min, boxMin(bounds, items[i]));
+				node.max = glm::max(node.max, boxMax(bounds, items[i]));
+			}
+		}
+
+		/*
+			Bin the items of a leaf by centroid along each axis and pick the plane with the lowest SAH cost
+			Partitions items and returns the first index of the right half, false if splitting does not pay off
+		*/
+		bool findSplit(const CullingBounds &bounds, const std::vector<glm::vec3> &centroids, const Node &node, uint32_t &split)
+		{
+			if (node.count <= maxLeafSize) {
+				return false;
+			}
+			glm::vec3 centroidMin(FLT_MAX);
+			glm::vec3 centroidMax(-FLT_MAX);
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				centroidMin = glm::min(centroidMin, centroids[items[i]]);
+				centroidMax = glm::max(centroidMax, centroids[items[i]]);
+			}
+
+			// Cost of intersecting all items of the leaf, relative to the area of the node
+			float bestCost = static_cast<float>(node.count) * surfaceArea(node.min, node.max);
+			int bestAxis = -1;
+			uint32_t bestBin = 0;
+			for (int axis = 0; axis < 3; axis++) {
+				const float extent = centroidMax[axis] - centroidMin[axis];
+				if (extent <= 0.0f) {
+					continue;
+				}
+				const float scale = BINS / extent;
+				glm::vec3 binMin[BINS], binMax[BINS];
+				uint32_t binCount[BINS] = {};
+				for (uint32_t b = 0; b < BINS; b++) {
+					binMin[b] = glm::vec3(FLT_MAX);
+					binMax[b] = glm::vec3(-FLT_MAX);
+				}
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					const uint32_t item = items[i];
+					const uint32_t b = std::min(BINS - 1, static_cast<uint32_t>((centroids[item][axis] - centroidMin[axis]) * scale));
+					binMin[b] = glm::min(binMin[b], boxMin(bounds, item));
+					binMax[b] = glm::max(binMax[b], boxMax(bounds, item));
+					binCount[b]++;
+				}
+
+				// Sweep from the right to get the cost of every right half, then from the left
+				float rightArea[BINS];
+				uint32_t rightCount[BINS];
+				glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+				uint32_t count = 0;
+				for (uint32_t b = BINS - 1; b > 0; b--) {
+					min = glm::min(min, binMin[b]);
+					max = glm::max(max, binMax[b]);
+					count += binCount[b];
+					rightArea[b] = surfaceArea(min, max);
+					rightCount[b] = count;
+				}
+				min = glm::vec3(FLT_MAX);
+				max = glm::vec3(-FLT_MAX);
+				count = 0;
+				for (uint32_t b = 0; b < BINS - 1; b++) {
+					min = glm::min(min, binMin[b]);
+					max = glm::max(max, binMax[b]);
+					count += binCount[b];
+					if (count == 0 || rightCount[b + 1] == 0) {
+						continue;
+					}
+					const float cost = count * surfaceArea(min, max) + rightCount[b + 1] * rightArea[b + 1];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = b + 1;
+					}
+				}
+			}
+			if (bestAxis < 0) {
+				return false;
+			}
+
+			const float scale = BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+			uint32_t *middle = std::partition(&items[node.first], &items[node.first] + node.count, [&](uint32_t item) {
+				return std::min(BINS - 1, static_cast<uint32_t>((centroids[item][bestAxis] - centroidMin[bestAxis]) * scale)) < bestBin;
+			});
+			split = static_cast<uint32_t>(middle - items.data());
+			return true;
+		}
+	};
+}
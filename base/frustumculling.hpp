@@ -0,0 +1,321 @@
+/*
+* CPU frustum culling of bounding boxes in structure-of-arrays layout
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// The AVX kernels are compiled for their own target on GCC and Clang and selected at runtime, other compilers
+// only build them if the whole program targets AVX
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define VKGLTF_CULLING_AVX 1
+#define VKGLTF_TARGET_AVX __attribute__((target("avx")))
+#elif defined(__AVX__)
+#define VKGLTF_CULLING_AVX 1
+#define VKGLTF_TARGET_AVX
+#endif
+
+#if defined(VKGLTF_CULLING_AVX)
+#include <immintrin.h>
+#endif
+
+namespace vkglTF
+{
+	/*
+		Six normalized planes (left, right, bottom, top, near, far) with inside points at dot(plane.xyz, p) + plane.w >= 0
+	*/
+	struct Frustum {
+		glm::vec4 planes[6];
+
+		Frustum() {}
+
+		// Planes of the clip volume of a view projection matrix with a [0, 1] depth range, in the matrix' source space
+		explicit Frustum(const glm::mat4 &m)
+		{
+			for (int i = 0; i < 2; i++) {
+				for (int side = 0; side < 2; side++) {
+					const float sign = side == 0 ? 1.0f : -1.0f;
+					planes[i * 2 + side] = glm::vec4(m[0][3] + sign * m[0][i], m[1][3] + sign * m[1][i], m[2][3] + sign * m[2][i], m[3][3] + sign * m[3][i]);
+				}
+			}
+			planes[4] = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+			planes[5] = glm::vec4(m[0][3] - m[0][2], m[1][3] - m[1][2], m[2][3] - m[2][2], m[3][3] - m[3][2]);
+			for (glm::vec4 &plane : planes) {
+				plane /= glm::length(glm::vec3(plane));
+			}
+		}
+
+		// -1 if the box is outside of a plane, 1 if it is inside of all planes, 0 if it intersects the frustum's border
+		int classify(const glm::vec3 &min, const glm::vec3 &max) const
+		{
+			const glm::vec3 center = 0.5f * (min + max);
+			const glm::vec3 extent = 0.5f * (max - min);
+			int result = 1;
+			for (const glm::vec4 &plane : planes) {
+				const float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+				const float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+				if (distance + radius < 0.0f) {
+					return -1;
+				}
+				if (distance - radius < 0.0f) {
+					result = 0;
+				}
+			}
+			return result;
+		}
+	};
+
+	/*
+		World space boxes of many objects for frustum culling on the CPU
+		Each box has local bounds and the index of the matrix placing it in the world. refresh() recomputes the world
+		boxes from the current matrices with the math of BoundingBox::getAABB, cull() tests them against a frustum into
+		the visible bitset. Both process eight boxes per AVX iteration, with a scalar path for other CPUs
+		Boxes added as not cullable (e.g. deformed by skinning) are always visible
+	*/
+	struct CullingBounds {
+		static const uint32_t LANES = 8;
+
+		uint32_t count = 0;
+		// Local bounds and world bounds per axis, padded to a multiple of LANES
+		std::vector<float> localMin[3];
+		std::vector<float> localMax[3];
+		std::vector<float> worldMin[3];
+		std::vector<float> worldMax[3];
+		std::vector<uint32_t> matrixIndices;
+		// One bit per box, 64 boxes per word
+		std::vector<uint64_t> alwaysVisible;
+		std::vector<uint64_t> visible;
+		bool useAVX = supportsAVX();
+
+		static bool supportsAVX()
+		{
+#if defined(VKGLTF_CULLING_AVX) && (defined(__GNUC__) || defined(__clang__))
+			return __builtin_cpu_supports("avx") != 0;
+#elif defined(VKGLTF_CULLING_AVX)
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		void clear()
+		{
+			count = 0;
+			for (int axis = 0; axis < 3; axis++) {
+				localMin[axis].clear();
+				localMax[axis].clear();
+				worldMin[axis].clear();
+				worldMax[axis].clear();
+			}
+			matrixIndices.clear();
+			alwaysVisible.clear();
+			visible.clear();
+		}
+
+		// Returns the index of the new box, boxes are tested in the order they were added
+		uint32_t add(const glm::vec3 &min, const glm::vec3 &max, uint32_t matrixIndex, bool cullable = true)
+		{
+			const uint32_t index = count++;
+			const size_t padded = (count + LANES - 1) / LANES * LANES;
+			for (int axis = 0; axis < 3; axis++) {
+				// Padding boxes are empty and placed by matrix 0, their visibility bits are never read
+				localMin[axis].resize(padded, 0.0f);
+				localMax[axis].resize(padded, 0.0f);
+				worldMin[axis].resize(padded, 0.0f);
+				worldMax[axis].resize(padded, 0.0f);
+				localMin[axis][index] = min[axis];
+				localMax[axis][index] = max[axis];
+			}
+			matrixIndices.resize(padded, 0);
+			matrixIndices[index] = matrixIndex;
+			alwaysVisible.resize((padded + 63) / 64, 0);
+			visible.resize(alwaysVisible.size(), 0);
+			if (!cullable) {
+				alwaysVisible[index / 64] |= uint64_t(1) << (index % 64);
+			}
+			return index;
+		}
+
+		bool isVisible(uint32_t index) const
+		{
+			return (visible[index / 64] >> (index % 64) & 1) != 0;
+		}
+
+		uint32_t visibleCount() const
+		{
+			uint32_t result = 0;
+			for (uint32_t i = 0; i < count; i++) {
+				result += isVisible(i) ? 1 : 0;
+			}
+			return result;
+		}
+
+		// Recompute all world boxes, matrices must hold every matrix index used by add()
+		void refresh(const std::vector<glm::mat4> &matrices)
+		{
+			if (count == 0) {
+				return;
+			}
+#if defined(VKGLTF_CULLING_AVX)
+			if (useAVX) {
+				refreshAVX(matrices);
+				return;
+			}
+#endif
+			refreshScalar(matrices);
+		}
+
+		void cull(const Frustum &frustum)
+		{
+			if (count == 0) {
+				return;
+			}
+#if defined(VKGLTF_CULLING_AVX)
+			if (useAVX) {
+				cullAVX(frustum);
+			} else {
+				cullScalar(frustum);
+			}
+#else
+			cullScalar(frustum);
+#endif
+			for (size_t i = 0; i < visible.size(); i++) {
+				visible[i] |= alwaysVisible[i];
+			}
+		}
+
+		void refreshScalar(const std::vector<glm::mat4> &matrices)
+		{
+			const size_t padded = localMin[0].size();
+			for (size_t i = 0; i < padded; i++) {
+				const glm::mat4 &m = matrices[matrixIndices[i]];
+				glm::vec3 min = glm::vec3(m[3]);
+				glm::vec3 max = min;
+				for (int axis = 0; axis < 3; axis++) {
+					const glm::vec3 column = glm::vec3(m[axis]);
+					const glm::vec3 v0 = column * localMin[axis][i];
+					const glm::vec3 v1 = column * localMax[axis][i];
+					min += glm::min(v0, v1);
+					max += glm::max(v0, v1);
+				}
+				for (int axis = 0; axis < 3; axis++) {
+					worldMin[axis][i] = min[axis];
+					worldMax[axis][i] = max[axis];
+				}
+			}
+		}
+
+		void cullScalar(const Frustum &frustum)
+		{
+			std::fill(visible.begin(), visible.end(), 0);
+			for (uint32_t i = 0; i < count; i++) {
+				const glm::vec3 center = 0.5f * glm::vec3(worldMin[0][i] + worldMax[0][i], worldMin[1][i] + worldMax[1][i], worldMin[2][i] + worldMax[2][i]);
+				const glm::vec3 extent = 0.5f * glm::vec3(worldMax[0][i] - worldMin[0][i], worldMax[1][i] - worldMin[1][i], worldMax[2][i] - worldMin[2][i]);
+				bool inside = true;
+				for (int p = 0; p < 6 && inside; p++) {
+					// Same operation order as cullAVX, so both paths agree on boxes touching a plane
+					const glm::vec4 &plane = frustum.planes[p];
+					float distance = plane.w;
+					float radius = 0.0f;
+					for (int axis = 0; axis < 3; axis++) {
+						distance += plane[axis] * center[axis];
+						radius += std::abs(plane[axis]) * extent[axis];
+					}
+					inside = distance + radius >= 0.0f;
+				}
+				if (inside) {
+					visible[i / 64] |= uint64_t(1) << (i % 64);
+				}
+			}
+		}
+
+#if defined(VKGLTF_CULLING_AVX)
+		VKGLTF_TARGET_AVX void refreshAVX(const std::vector<glm::mat4> &matrices)
+		{
+			const size_t padded = localMin[0].size();
+			alignas(32) float columns[12][LANES];
+			for (size_t i = 0; i < padded; i += LANES) {
+				// Transpose the eight matrices into one register per element of the upper 3x4 part
+				for (uint32_t lane = 0; lane < LANES; lane++) {
+					const glm::mat4 &m = matrices[matrixIndices[i + lane]];
+					for (int c = 0; c < 4; c++) {
+						for (int r = 0; r < 3; r++) {
+							columns[c * 3 + r][lane] = m[c][r];
+						}
+					}
+				}
+				__m256 min[3], max[3];
+				for (int r = 0; r < 3; r++) {
+					min[r] = max[r] = _mm256_load_ps(columns[9 + r]);
+				}
+				for (int axis = 0; axis < 3; axis++) {
+					const __m256 lo = _mm256_loadu_ps(&localMin[axis][i]);
+					const __m256 hi = _mm256_loadu_ps(&localMax[axis][i]);
+					for (int r = 0; r < 3; r++) {
+						const __m256 column = _mm256_load_ps(columns[axis * 3 + r]);
+						const __m256 v0 = _mm256_mul_ps(column, lo);
+						const __m256 v1 = _mm256_mul_ps(column, hi);
+						min[r] = _mm256_add_ps(min[r], _mm256_min_ps(v0, v1));
+						max[r] = _mm256_add_ps(max[r], _mm256_max_ps(v0, v1));
+					}
+				}
+				for (int r = 0; r < 3; r++) {
+					_mm256_storeu_ps(&worldMin[r][i], min[r]);
+					_mm256_storeu_ps(&worldMax[r][i], max[r]);
+				}
+			}
+		}
+
+		VKGLTF_TARGET_AVX void cullAVX(const Frustum &frustum)
+		{
+			const __m256 half = _mm256_set1_ps(0.5f);
+			const __m256 signMask = _mm256_set1_ps(-0.0f);
+			__m256 planes[6][4];
+			for (int p = 0; p < 6; p++) {
+				for (int c = 0; c < 4; c++) {
+					planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+				}
+			}
+
+			std::fill(visible.begin(), visible.end(), 0);
+			const size_t padded = localMin[0].size();
+			for (size_t i = 0; i < padded; i += LANES) {
+				__m256 center[3], extent[3];
+				for (int axis = 0; axis < 3; axis++) {
+					const __m256 lo = _mm256_loadu_ps(&worldMin[axis][i]);
+					const __m256 hi = _mm256_loadu_ps(&worldMax[axis][i]);
+					center[axis] = _mm256_mul_ps(_mm256_add_ps(lo, hi), half);
+					extent[axis] = _mm256_mul_ps(_mm256_sub_ps(hi, lo), half);
+				}
+				__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for (int p = 0; p < 6; p++) {
+					// Signed distance of the box center against the projected radius of the box on the plane normal
+					__m256 distance = planes[p][3];
+					__m256 radius = _mm256_setzero_ps();
+					for (int axis = 0; axis < 3; axis++) {
+						distance = _mm256_add_ps(distance, _mm256_mul_ps(planes[p][axis], center[axis]));
+						radius = _mm256_add_ps(radius, _mm256_mul_ps(_mm256_andnot_ps(signMask, planes[p][axis]), extent[axis]));
+					}
+					inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+				}
+				const uint64_t bits = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+				visible[i / 64] |= bits << (i % 64);
+			}
+			// Padding boxes past count are never reported visible
+			if (count % 64 != 0) {
+				visible[count / 64] &= (uint64_t(1) << (count % 64)) - 1;
+			}
+		}
+#endif
+	};
+}
@@ -0,0 +1,73 @@
+/*
+* Keyframe lookup for glTF animation samplers
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+namespace vkglTF
+{
+	/*
+		Locate the keyframe segment [cursor, cursor + 1] containing time in a sorted array of keyframe times
+		cursor holds the segment found by the previous call. Playback advances by at most one key per frame in the
+		common case, so that segment and its successor are tried before falling back to a binary search
+		If several segments contain time (repeated key times), the last one is used
+		Times before the first or after the last key clamp to the first or last segment as glTF requires, keyframeFactor
+		then returns 0 or 1 so the boundary key's value is held
+		A single key is segment 0 with factor 0, its value is held at all times
+		Returns false and leaves cursor unchanged if there are no keys or time is not a number
+	*/
+	inline bool findKeyframe(const std::vector<float> &times, float time, uint32_t &cursor)
+	{
+		const uint32_t count = static_cast<uint32_t>(times.size());
+		if (count == 0 || time != time) {
+			return false;
+		}
+		if (count == 1) {
+			cursor = 0;
+			return true;
+		}
+		const uint32_t last = count - 2;
+		if (time <= times[0]) {
+			cursor = 0;
+			return true;
+		}
+		if (time >= times[count - 1]) {
+			cursor = last;
+			return true;
+		}
+		for (uint32_t i = cursor; i <= cursor + 1 && i <= last; i++) {
+			if (times[i] <= time && (i == last || time < times[i + 1])) {
+				cursor = i;
+				return true;
+			}
+		}
+		const uint32_t upper = static_cast<uint32_t>(std::upper_bound(times.begin(), times.end(), time) - times.begin());
+		cursor = std::min(upper - 1, last);
+		return true;
+	}
+
+	// Key ending the segment found by findKeyframe, the segment's own key if it is the only one
+	inline uint32_t nextKeyframe(const std::vector<float> &times, uint32_t segment)
+	{
+		return segment + 1 < times.size() ? segment + 1 : segment;
+	}
+
+	// Interpolation factor of time within the segment found by findKeyframe
+	inline float keyframeFactor(const std::vector<float> &times, float time, uint32_t segment)
+	{
+		if (segment + 1 >= times.size()) {
+			return 0.0f;
+		}
+		const float duration = times[segment + 1] - times[segment];
+		if (!(duration > 0.0f)) {
+			return time >= times[segment + 1] ? 1.0f : 0.0f;
+		}
+		return std::min(std::max(time - times[segment], 0.0f) / duration, 1.0f);
+	}
+}
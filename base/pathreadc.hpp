@@ -14,6 +14,8 @@ struct CameraCheckpoint {
     glm::vec3 point;
     glm::vec3 dir;
     int t;
+    // Scene (animation) time in seconds, negative if the checkpoint does not specify one
+    float time;
 };
 
 
@@ -40,6 +42,11 @@ CameraCheckpoint cpFromObj(json_object* obj) {
 
     cc.t = json_object_get_int(tobj);
 
+    cc.time = -1.0f;
+    if(json_object_object_get_ex(obj, "time", &tobj)) {
+	cc.time = float(json_object_get_double(tobj));
+    }
+
     return cc;
 }
 
@@ -51,6 +58,7 @@ CameraCheckpoint getInterpolatedCheckpoint(const CameraCheckpoint& cc1,
     CameraCheckpoint cc;
     cc.point = coeff * cc2.point + (1 - coeff) * cc1.point;
     cc.dir = glm::normalize(coeff * cc2.dir + (1 - coeff) * cc1.dir);
+    cc.time = coeff * cc2.time + (1 - coeff) * cc1.time;
 
     return cc;
 }
@@ -144,9 +152,22 @@ std::pair<glm::vec3, glm::vec3> getInterpolatedComp(const CameraCheckpoint& cp1,
     return std::pair<glm::vec3, glm::vec3>(glm::vec3(pitch, yaw, 0.0f) * 180.0 / M_PI, cc.point);
 }
 
+// Checkpoints without a scene time get the one implied by their frame number
+void resolveCheckpointTimes(std::vector<CameraCheckpoint>& cps, float framesPerSecond) {
+    for(CameraCheckpoint& cc : cps) {
+	if(cc.time < 0.0f) {
+	    cc.time = cc.t / framesPerSecond;
+	}
+    }
+}
+
 // Decomposed as in returning path as  (rotation, position) pairs, where rotation is on Euler form
-std::vector<std::pair<glm::vec3, glm::vec3> > getPathDecomposed(const std::string& str) {
+// If times is given, it receives the scene time of every frame, interpolated between checkpoints like the camera
+std::vector<std::pair<glm::vec3, glm::vec3> > getPathDecomposed(const std::string& str,
+								 std::vector<float>* times = nullptr,
+								 float framesPerSecond = 60.0f) {
     std::vector<CameraCheckpoint> cps = parse_to_cc(str);
+    resolveCheckpointTimes(cps, framesPerSecond);
 
     std::vector<std::pair<glm::vec3, glm::vec3> > comps;
 
@@ -155,6 +176,9 @@ std::vector<std::pair<glm::vec3, glm::vec3> > getPathDecomposed(const std::strin
     while(current_cp < cps.size() - 1) {
       
         comps.push_back(getInterpolatedComp(cps[current_cp], cps[current_cp + 1], t));
+	if(times) {
+	    times->push_back(getInterpolatedCheckpoint(cps[current_cp], cps[current_cp + 1], t).time);
+	}
 	// std::cout << "Rotation " << t << ": " << glm::to_string(comps[comps.size() - 1].first) << std::endl;
 	// std::cout << "Position " << t << ": " << glm::to_string(comps[comps.size() - 1].second) << std::endl;
 	t++;
@@ -164,6 +188,9 @@ std::vector<std::pair<glm::vec3, glm::vec3> > getPathDecomposed(const std::strin
     }
 
     comps.push_back(getInterpolatedComp(cps[current_cp - 1], cps[current_cp], t));
+    if(times) {
+	times->push_back(getInterpolatedCheckpoint(cps[current_cp - 1], cps[current_cp], t).time);
+    }
 
     return comps;
 }
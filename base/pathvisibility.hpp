@@ -0,0 +1,141 @@
+/*
+* Precomputed visibility of draws over the frames of a known camera path
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+namespace vkglTF
+{
+	/*
+		Visible draws of every frame of a camera path
+		Each frame's visibility bitset is stored run-length encoded as alternating lengths of invisible and visible
+		draws, starting with invisible ones. Neighbouring draws of the state sorted draw list tend to share visibility,
+		so most frames only need a few runs
+	*/
+	struct PathVisibility {
+		uint32_t drawCount = 0;
+		// Runs of frame i are runs[frameOffsets[i], frameOffsets[i + 1])
+		std::vector<uint32_t> frameOffsets;
+		std::vector<uint32_t> runs;
+		// Draws visible in at least one frame
+		std::vector<uint64_t> everVisible;
+
+		void clear()
+		{
+			drawCount = 0;
+			frameOffsets.clear();
+			runs.clear();
+			everVisible.clear();
+		}
+
+		uint32_t frameCount() const
+		{
+			return frameOffsets.empty() ? 0 : static_cast<uint32_t>(frameOffsets.size() - 1);
+		}
+
+		static bool bit(const std::vector<uint64_t> &bits, uint32_t index)
+		{
+			return (bits[index / 64] >> (index % 64) & 1) != 0;
+		}
+
+		static void encode(const std::vector<uint64_t> &bits, uint32_t count, std::vector<uint32_t> &runs)
+		{
+			runs.clear();
+			bool visible = false;
+			uint32_t length = 0;
+			for (uint32_t i = 0; i < count; i++) {
+				if (bit(bits, i) != visible) {
+					runs.push_back(length);
+					visible = !visible;
+					length = 0;
+				}
+				length++;
+			}
+			runs.push_back(length);
+		}
+
+		// Set the frames from their encoded runs, all encoded over count draws
+		void assign(const std::vector<std::vector<uint32_t> > &frames, uint32_t count)
+		{
+			clear();
+			drawCount = count;
+			everVisible.assign((count + 63) / 64, 0);
+			frameOffsets.push_back(0);
+			std::vector<uint64_t> bits;
+			for (uint32_t frame = 0; frame < frames.size(); frame++) {
+				runs.insert(runs.end(), frames[frame].begin(), frames[frame].end());
+				frameOffsets.push_back(static_cast<uint32_t>(runs.size()));
+				decode(frame, bits);
+				for (size_t i = 0; i < bits.size(); i++) {
+					everVisible[i] |= bits[i];
+				}
+			}
+		}
+
+		void decode(uint32_t frame, std::vector<uint64_t> &bits) const
+		{
+			bits.assign((drawCount + 63) / 64, 0);
+			uint32_t index = 0;
+			for (uint32_t r = frameOffsets[frame]; r < frameOffsets[frame + 1]; r++) {
+				const bool visible = (r - frameOffsets[frame]) % 2 == 1;
+				const uint32_t end = index + runs[r];
+				if (visible) {
+					for (; index < end && index % 64 != 0; index++) {
+						bits[index / 64] |= uint64_t(1) << (index % 64);
+					}
+					for (; index + 64 <= end; index += 64) {
+						bits[index / 64] = ~uint64_t(0);
+					}
+					for (; index < end; index++) {
+						bits[index / 64] |= uint64_t(1) << (index % 64);
+					}
+				}
+				index = end;
+			}
+		}
+
+		uint32_t everVisibleCount() const
+		{
+			uint32_t result = 0;
+			for (uint32_t i = 0; i < drawCount; i++) {
+				result += bit(everVisible, i) ? 1 : 0;
+			}
+			return result;
+		}
+
+		// Drop all draws never visible, to match a draw list filtered by everVisible with the order of the others kept
+		void compact()
+		{
+			const uint32_t count = everVisibleCount();
+			std::vector<std::vector<uint32_t> > frames(frameCount());
+			std::vector<uint64_t> bits, compacted;
+			for (uint32_t frame = 0; frame < frameCount(); frame++) {
+				decode(frame, bits);
+				compacted.assign((count + 63) / 64, 0);
+				uint32_t index = 0;
+				for (uint32_t i = 0; i < drawCount; i++) {
+					if (!bit(everVisible, i)) {
+						continue;
+					}
+					if (bit(bits, i)) {
+						compacted[index / 64] |= uint64_t(1) << (index % 64);
+					}
+					index++;
+				}
+				encode(compacted, count, frames[frame]);
+			}
+			assign(frames, count);
+		}
+
+		size_t sizeInBytes() const
+		{
+			return (frameOffsets.size() + runs.size()) * sizeof(uint32_t) + everVisible.size() * sizeof(uint64_t);
+		}
+	};
+}
@@ -0,0 +1,169 @@
+/*
+* Basic thread pool for moving CPU work (image output, scene updates) off the render loop
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+
+namespace vks
+{
+	class ThreadPool
+	{
+	private:
+		std::vector<std::thread> workers;
+		std::queue<std::function<void()> > jobs;
+		std::mutex queueMutex;
+		std::condition_variable jobAvailable;
+		std::condition_variable jobFinished;
+		size_t activeJobs = 0;
+		size_t maxQueuedJobs = 0;
+		bool destroying = false;
+
+		void loop()
+		{
+			while (true) {
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(queueMutex);
+					jobAvailable.wait(lock, [this] { return !jobs.empty() || destroying; });
+					if (jobs.empty()) {
+						return;
+					}
+					job = std::move(jobs.front());
+					jobs.pop();
+					activeJobs++;
+				}
+				// Wake up producers that are blocked on a full queue
+				jobFinished.notify_all();
+				job();
+				{
+					std::lock_guard<std::mutex> lock(queueMutex);
+					activeJobs--;
+				}
+				jobFinished.notify_all();
+			}
+		}
+
+	public:
+		ThreadPool() {}
+
+		ThreadPool(size_t count, size_t maxQueuedJobs = 0)
+		{
+			setThreadCount(count, maxQueuedJobs);
+		}
+
+		~ThreadPool()
+		{
+			stop();
+		}
+
+		/*
+			(Re)creates the worker threads after finishing all pending work
+			maxQueuedJobs > 0 makes enqueue() block while that many jobs are waiting, which bounds memory use when producers outpace the workers
+		*/
+		void setThreadCount(size_t count, size_t maxQueuedJobs = 0)
+		{
+			stop();
+			if (count == 0) {
+				count = std::max(1u, std::thread::hardware_concurrency());
+			}
+			this->maxQueuedJobs = maxQueuedJobs;
+			destroying = false;
+			for (size_t i = 0; i < count; i++) {
+				workers.push_back(std::thread(&ThreadPool::loop, this));
+			}
+		}
+
+		size_t size() const
+		{
+			return workers.size();
+		}
+
+		void enqueue(std::function<void()> job)
+		{
+			// Without workers, jobs are run on the calling thread
+			if (workers.empty()) {
+				job();
+				return;
+			}
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				if (maxQueuedJobs > 0) {
+					jobFinished.wait(lock, [this] { return jobs.size() < maxQueuedJobs; });
+				}
+				jobs.push(std::move(job));
+			}
+			jobAvailable.notify_one();
+		}
+
+		// Blocks until all enqueued jobs have finished
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			jobFinished.wait(lock, [this] { return jobs.empty() && activeJobs == 0; });
+		}
+
+		/*
+			Calls job(i) for every i in [0, count) on the workers and the calling thread and returns once all calls have finished
+			Indices are handed out dynamically, so results must not depend on which thread runs a job
+		*/
+		void parallelFor(size_t count, const std::function<void(size_t)> &job)
+		{
+			const size_t helpers = std::min(workers.size(), count > 0 ? count - 1 : 0);
+			if (helpers == 0) {
+				for (size_t i = 0; i < count; i++) {
+					job(i);
+				}
+				return;
+			}
+			std::atomic<size_t> next(0);
+			size_t running = helpers;
+			std::mutex doneMutex;
+			std::condition_variable done;
+			auto run = [&]() {
+				for (size_t i = next++; i < count; i = next++) {
+					job(i);
+				}
+			};
+			for (size_t i = 0; i < helpers; i++) {
+				enqueue([&]() {
+					run();
+					// Notify under the lock, the caller may return and destroy done as soon as running reaches zero
+					std::lock_guard<std::mutex> lock(doneMutex);
+					running--;
+					done.notify_one();
+				});
+			}
+			run();
+			std::unique_lock<std::mutex> lock(doneMutex);
+			done.wait(lock, [&] { return running == 0; });
+		}
+
+		void stop()
+		{
+			if (workers.empty()) {
+				return;
+			}
+			wait();
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				destroying = true;
+			}
+			jobAvailable.notify_all();
+			for (auto &worker : workers) {
+				worker.join();
+			}
+			workers.clear();
+		}
+	};
+}
@@ -0,0 +1,262 @@
+/*
+* Flattened glTF node transform hierarchy
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <functional>
+#include <assert.h>
+#include <stdint.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "threadpool.hpp"
+
+namespace vkglTF
+{
+	/*
+		Node transforms in structure-of-arrays layout
+		Nodes are stored in depth-first pre-order, so every parent precedes its children and all
+		world matrices can be computed in one linear pass without walking parent chains
+		The subtree of node i is the contiguous range [i, subtreeEnds[i]), which lets changed nodes
+		be propagated incrementally with updateDirty()
+		Both updates can be spread over a thread pool. Every world matrix is still computed by exactly one thread with the
+		same operations, so the results do not depend on the number of threads
+	*/
+	struct TransformHierarchy {
+		// Called with each [first, last) range once its world matrices are final, possibly from several threads at once
+		typedef std::function<void(uint32_t, uint32_t)> RangeCallback;
+
+		std::vector<int32_t> parents;            // -1 for root nodes, otherwise smaller than the node's own index
+		std::vector<glm::vec3> translations;
+		std::vector<glm::quat> rotations;
+		std::vector<glm::vec3> scales;
+		std::vector<glm::mat4> matrices;         // Optional static node matrix, applied after TRS
+		std::vector<uint8_t> hasMatrix;
+		std::vector<glm::mat4> worldMatrices;
+		std::vector<uint32_t> subtreeEnds;
+		bool subtreeEndsValid = true;
+
+		// Nodes with changed local transforms since the last update
+		std::vector<uint32_t> dirtyNodes;
+		// Disjoint, sorted [first, last) ranges recomputed by the last update
+		std::vector<std::pair<uint32_t, uint32_t> > updatedRanges;
+
+		/*
+			Parallel updates split large subtrees into a serial spine of ancestors and independent ranges of at most
+			grainSize nodes below it
+		*/
+		uint32_t grainSize = 512;
+		std::vector<uint32_t> spineNodes;
+		std::vector<std::pair<uint32_t, uint32_t> > batches;
+		std::vector<uint32_t> partitionStack;
+
+		uint32_t add(int32_t parent, const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale, const glm::mat4 &matrix = glm::mat4(1.0f))
+		{
+			const uint32_t index = static_cast<uint32_t>(parents.size());
+			assert(parent < static_cast<int32_t>(index));
+			parents.push_back(parent);
+			translations.push_back(translation);
+			rotations.push_back(rotation);
+			scales.push_back(scale);
+			matrices.push_back(matrix);
+			hasMatrix.push_back(matrix != glm::mat4(1.0f));
+			worldMatrices.push_back(glm::mat4(1.0f));
+			subtreeEnds.push_back(index + 1);
+			subtreeEndsValid = false;
+			return index;
+		}
+
+		size_t size() const
+		{
+			return parents.size();
+		}
+
+		void clear()
+		{
+			parents.clear();
+			translations.clear();
+			rotations.clear();
+			scales.clear();
+			matrices.clear();
+			hasMatrix.clear();
+			worldMatrices.clear();
+			subtreeEnds.clear();
+			subtreeEndsValid = true;
+			dirtyNodes.clear();
+			updatedRanges.clear();
+			spineNodes.clear();
+			batches.clear();
+		}
+
+		// Children are visited before their parents, so each parent sees the final end of its children's subtrees
+		void computeSubtreeEnds()
+		{
+			for (uint32_t i = static_cast<uint32_t>(size()); i-- > 0;) {
+				subtreeEnds[i] = std::max(subtreeEnds[i], i + 1);
+				if (parents[i] >= 0) {
+					subtreeEnds[parents[i]] = std::max(subtreeEnds[parents[i]], subtreeEnds[i]);
+				}
+			}
+			subtreeEndsValid = true;
+		}
+
+		// Flag a node whose translation, rotation, scale or matrix was changed
+		void markDirty(uint32_t index)
+		{
+			dirtyNodes.push_back(index);
+		}
+
+		// T * R * S * matrix, composed directly instead of through three 4x4 multiplications
+		glm::mat4 localMatrix(uint32_t index) const
+		{
+			const glm::mat3 r = glm::mat3_cast(rotations[index]);
+			const glm::vec3 &s = scales[index];
+			glm::mat4 m(
+				glm::vec4(r[0] * s.x, 0.0f),
+				glm::vec4(r[1] * s.y, 0.0f),
+				glm::vec4(r[2] * s.z, 0.0f),
+				glm::vec4(translations[index], 1.0f));
+			if (hasMatrix[index]) {
+				m = m * matrices[index];
+			}
+			return m;
+		}
+
+		/*
+			Compute world matrices for the nodes in [first, last)
+			Parents outside of the range must already have up to date world matrices
+		*/
+		void update(uint32_t first, uint32_t last)
+		{
+			for (uint32_t i = first; i < last; i++) {
+				const int32_t parent = parents[i];
+				worldMatrices[i] = parent < 0 ? localMatrix(i) : worldMatrices[parent] * localMatrix(i);
+			}
+		}
+
+		/*
+			Split the subtree of root into spine nodes and batches, both in pre-order
+			Subtrees with more than grainSize nodes put their root on the spine and are split further at their children
+		*/
+		void partition(uint32_t root)
+		{
+			partitionStack.push_back(root);
+			while (!partitionStack.empty()) {
+				const uint32_t index = partitionStack.back();
+				partitionStack.pop_back();
+				const uint32_t end = subtreeEnds[index];
+				if (end - index <= grainSize) {
+					// Sibling subtrees are adjacent, so small ones are merged into one batch
+					if (!batches.empty() && batches.back().second == index && end - batches.back().first <= grainSize) {
+						batches.back().second = end;
+					} else {
+						batches.push_back(std::make_pair(index, end));
+					}
+					continue;
+				}
+				spineNodes.push_back(index);
+				// Children are pushed in reverse to be visited in pre-order
+				const size_t first = partitionStack.size();
+				for (uint32_t child = index + 1; child < end; child = subtreeEnds[child]) {
+					partitionStack.push_back(child);
+				}
+				std::reverse(partitionStack.begin() + first, partitionStack.end());
+			}
+		}
+
+		/*
+			Compute world matrices for the subtrees in updatedRanges, whose roots' parents must be up to date
+		*/
+		void updateRanges(vks::ThreadPool *pool, const RangeCallback &visit)
+		{
+			if (!pool || pool->size() == 0) {
+				for (auto &range : updatedRanges) {
+					update(range.first, range.second);
+					if (visit) {
+						visit(range.first, range.second);
+					}
+				}
+				return;
+			}
+			spineNodes.clear();
+			batches.clear();
+			for (auto &range : updatedRanges) {
+				for (uint32_t root = range.first; root < range.second; root = subtreeEnds[root]) {
+					partition(root);
+				}
+			}
+			for (uint32_t index : spineNodes) {
+				update(index, index + 1);
+				if (visit) {
+					visit(index, index + 1);
+				}
+			}
+			pool->parallelFor(batches.size(), [&](size_t i) {
+				update(batches[i].first, batches[i].second);
+				if (visit) {
+					visit(batches[i].first, batches[i].second);
+				}
+			});
+		}
+
+		/*
+			Recompute all world matrices, optionally spread over a thread pool
+		*/
+		void update(vks::ThreadPool *pool = nullptr, const RangeCallback &visit = RangeCallback())
+		{
+			dirtyNodes.clear();
+			updatedRanges.clear();
+			if (size() > 0) {
+				if (!subtreeEndsValid) {
+					computeSubtreeEnds();
+				}
+				updatedRanges.push_back(std::make_pair(0u, static_cast<uint32_t>(size())));
+				updateRanges(pool, visit);
+			}
+		}
+
+		/*
+			Recompute world matrices only for the subtrees below dirty nodes
+			Returns the updated ranges, which are also kept in updatedRanges until the next update
+		*/
+		const std::vector<std::pair<uint32_t, uint32_t> > &updateDirty(vks::ThreadPool *pool = nullptr, const RangeCallback &visit = RangeCallback())
+		{
+			updatedRanges.clear();
+			if (dirtyNodes.empty()) {
+				return updatedRanges;
+			}
+			if (!subtreeEndsValid) {
+				computeSubtreeEnds();
+			}
+			std::sort(dirtyNodes.begin(), dirtyNodes.end());
+			uint32_t end = 0;
+			for (uint32_t index : dirtyNodes) {
+				// Already covered by the subtree of an earlier dirty ancestor
+				if (index < end) {
+					continue;
+				}
+				end = subtreeEnds[index];
+				updatedRanges.push_back(std::make_pair(index, end));
+			}
+			dirtyNodes.clear();
+			updateRanges(pool, visit);
+			return updatedRanges;
+		}
+
+		// True if the world matrix of the node changed in the last update
+		bool wasUpdated(uint32_t index) const
+		{
+			auto it = std::upper_bound(updatedRanges.begin(), updatedRanges.end(), std::make_pair(index, UINT32_MAX));
+			return it != updatedRanges.begin() && index < (it - 1)->second;
+		}
+	};
+}
@@ -0,0 +1,127 @@
+/*
+* Benchmark: animation evaluation for crowds of animated characters
+* Compares evaluating one channel at a time (the previous Model::updateAnimation) with the batched kernels of
+* vkglTF::Animation for each interpolation type, with keyframe times shared by all channels (one timeline, as
+* exporters usually write them) and with distinct times for every channel (one group per channel, the worst case)
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+
+#include "animation.hpp"
+#include "benchutils.hpp"
+
+/*
+	One translation, rotation and scale channel with its own sampler for each of nodeCount nodes
+	Without sharedTimes the first key of each sampler gets its own time before the clip, so no two samplers share a timeline
+*/
+void buildAnimation(uint32_t nodeCount, uint32_t keyCount, vkglTF::AnimationSampler::InterpolationType interpolation, bool sharedTimes, vkglTF::Animation &animation)
+{
+	bench::Random rnd(nodeCount + keyCount);
+	animation = vkglTF::Animation();
+	for (uint32_t node = 0; node < nodeCount; node++) {
+		for (int path = 0; path < 3; path++) {
+			vkglTF::AnimationSampler sampler;
+			sampler.interpolation = interpolation;
+			for (uint32_t k = 0; k < keyCount; k++) {
+				sampler.inputs.push_back(k == 0 && !sharedTimes ? -1.0f - (node * 3 + path) * 1e-3f : k / 30.0f);
+				for (uint32_t v = 0; v < sampler.outputStride(); v++) {
+					glm::vec4 value(rnd.uniform(-1.0f, 1.0f), rnd.uniform(-1.0f, 1.0f), rnd.uniform(-1.0f, 1.0f), rnd.uniform(0.5f, 1.0f));
+					if (path == vkglTF::AnimationChannel::ROTATION) {
+						value = glm::normalize(value);
+					}
+					sampler.outputsVec4.push_back(value);
+				}
+			}
+			vkglTF::AnimationChannel channel;
+			channel.path = static_cast<vkglTF::AnimationChannel::PathType>(path);
+			channel.node = node;
+			channel.samplerIndex = static_cast<uint32_t>(animation.samplers.size());
+			animation.samplers.push_back(sampler);
+			animation.channels.push_back(channel);
+		}
+	}
+	animation.start = 0.0f;
+	animation.end = (keyCount - 1) / 30.0f;
+	animation.compile();
+}
+
+// Previous evaluation: one channel at a time, linear interpolation for all samplers
+void evaluateChannels(vkglTF::Animation &animation, float time, vkglTF::TransformHierarchy &hierarchy)
+{
+	for (auto &channel : animation.channels) {
+		vkglTF::AnimationSampler &sampler = animation.samplers[channel.samplerIndex];
+		if (!vkglTF::findKeyframe(sampler.inputs, time, sampler.cursor)) {
+			continue;
+		}
+		const uint32_t i = sampler.cursor;
+		const uint32_t next = vkglTF::nextKeyframe(sampler.inputs, i);
+		const float u = vkglTF::keyframeFactor(sampler.inputs, time, i);
+		switch (channel.path) {
+		case vkglTF::AnimationChannel::TRANSLATION:
+			hierarchy.translations[channel.node] = glm::vec3(glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[next], u));
+			break;
+		case vkglTF::AnimationChannel::SCALE:
+			hierarchy.scales[channel.node] = glm::vec3(glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[next], u));
+			break;
+		case vkglTF::AnimationChannel::ROTATION: {
+			const glm::vec4 &a = sampler.outputsVec4[i];
+			const glm::vec4 &b = sampler.outputsVec4[next];
+			hierarchy.rotations[channel.node] = glm::normalize(glm::slerp(glm::quat(a.w, a.x, a.y, a.z), glm::quat(b.w, b.x, b.y, b.z), u));
+			break;
+		}
+		default:
+			break;
+		}
+		hierarchy.markDirty(channel.node);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	// 256 characters with 64 joints each by default
+	const uint32_t nodeCount = argc > 1 ? atoi(argv[1]) : 256 * 64;
+	const uint32_t keyCount = 300;
+	const uint32_t frameCount = 60;
+
+	vkglTF::TransformHierarchy hierarchy;
+	for (uint32_t i = 0; i < nodeCount; i++) {
+		hierarchy.add(-1, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+	}
+
+	std::cout << "nodes: " << nodeCount << ", channels: " << nodeCount * 3 << ", keys per channel: " << keyCount << ", frames per run: " << frameCount << std::endl;
+	std::cout << std::setw(14) << "interpolation" << std::setw(8) << "times" << std::setw(16) << "per channel ms" << std::setw(12) << "batched ms"
+		<< std::setw(10) << "speedup" << std::endl;
+
+	const char *names[] = { "LINEAR", "STEP", "CUBICSPLINE" };
+	vkglTF::Animation animation;
+	for (int interpolation = 0; interpolation < 3; interpolation++) {
+		for (int shared = 1; shared >= 0; shared--) {
+			buildAnimation(nodeCount, keyCount, static_cast<vkglTF::AnimationSampler::InterpolationType>(interpolation), shared != 0, animation);
+
+			// The per channel path only implements linear interpolation, it is timed on the same data for reference
+			double channelTime = bench::measure([&]() {
+				for (uint32_t f = 0; f < frameCount; f++) {
+					evaluateChannels(animation, f / 60.0f, hierarchy);
+					hierarchy.dirtyNodes.clear();
+				}
+				bench::sink = hierarchy.translations[nodeCount - 1].x;
+			});
+			double batchedTime = bench::measure([&]() {
+				for (uint32_t f = 0; f < frameCount; f++) {
+					animation.evaluate(f / 60.0f, hierarchy);
+					hierarchy.dirtyNodes.clear();
+				}
+				bench::sink = hierarchy.translations[nodeCount - 1].x;
+			});
+
+			std::cout << std::setw(14) << names[interpolation] << std::setw(8) << (shared ? "shared" : "own") << std::setw(16) << channelTime
+				<< std::setw(12) << batchedTime << std::setw(10) << channelTime / batchedTime << std::endl;
+		}
+	}
+
+	return 0;
+}
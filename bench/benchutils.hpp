@@ -0,0 +1,51 @@
+/*
+* Small helpers shared by the CPU benchmarks
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+namespace bench
+{
+	// Runs func repeatedly and returns the median duration of one run in milliseconds
+	template<typename Func>
+	double measure(Func func, int runs = 9)
+	{
+		std::vector<double> times;
+		func(); // Warm up
+		for (int i = 0; i < runs; i++) {
+			auto tStart = std::chrono::high_resolution_clock::now();
+			func();
+			auto tEnd = std::chrono::high_resolution_clock::now();
+			times.push_back(std::chrono::duration<double, std::milli>(tEnd - tStart).count());
+		}
+		std::sort(times.begin(), times.end());
+		return times[times.size() / 2];
+	}
+
+	// Deterministic pseudo random numbers, so runs are comparable between builds
+	struct Random {
+		uint32_t state;
+		Random(uint32_t seed = 1) : state(seed) {}
+		uint32_t next()
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return state;
+		}
+		float uniform(float lo = 0.0f, float hi = 1.0f)
+		{
+			return lo + (hi - lo) * (next() & 0xffffff) / float(0x1000000);
+		}
+	};
+
+	// Keeps the compiler from discarding results of the benchmarked code
+	static volatile float sink;
+}
@@ -0,0 +1,110 @@
+/*
+* Benchmark: bounding volume hierarchy over scene boxes
+* Measures building and refitting vkglTF::BoundingVolumeHierarchy and compares frustum and ray queries against
+* testing every box
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "bvh.hpp"
+#include "benchutils.hpp"
+
+int main(int argc, char *argv[])
+{
+	const uint32_t boxCount = argc > 1 ? atoi(argv[1]) : 200000;
+	const uint32_t matrixCount = 4096;
+	const uint32_t rayCount = 1000;
+
+	// Clusters of boxes around a few thousand node matrices in a 400 unit cube
+	bench::Random rnd(boxCount);
+	std::vector<glm::mat4> matrices(matrixCount);
+	for (glm::mat4 &m : matrices) {
+		m = glm::translate(glm::mat4(1.0f), glm::vec3(rnd.uniform(-200.0f, 200.0f), rnd.uniform(-200.0f, 200.0f), rnd.uniform(-200.0f, 200.0f)));
+	}
+	vkglTF::CullingBounds bounds;
+	for (uint32_t i = 0; i < boxCount; i++) {
+		const glm::vec3 center(rnd.uniform(-5.0f, 5.0f), rnd.uniform(-5.0f, 5.0f), rnd.uniform(-5.0f, 5.0f));
+		const glm::vec3 halfSize(rnd.uniform(0.1f, 0.5f), rnd.uniform(0.1f, 0.5f), rnd.uniform(0.1f, 0.5f));
+		bounds.add(center - halfSize, center + halfSize, rnd.next() % matrixCount);
+	}
+	bounds.refresh(matrices);
+
+	const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 256.0f);
+	const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, -220.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const vkglTF::Frustum frustum(projection * view);
+
+	std::vector<glm::vec3> rayOrigins(rayCount), rayDirections(rayCount);
+	for (uint32_t i = 0; i < rayCount; i++) {
+		rayOrigins[i] = glm::vec3(rnd.uniform(-250.0f, 250.0f), rnd.uniform(-250.0f, 250.0f), -300.0f);
+		rayDirections[i] = glm::normalize(glm::vec3(rnd.uniform(-0.2f, 0.2f), rnd.uniform(-0.2f, 0.2f), 1.0f));
+	}
+
+	vkglTF::BoundingVolumeHierarchy bvh;
+	const double build = bench::measure([&]() {
+		bvh.build(bounds);
+		bench::sink = bvh.nodes[0].max.x;
+	}, 5);
+
+	// Move every node a bit, then refit the tree to the new boxes
+	for (glm::mat4 &m : matrices) {
+		m = glm::translate(m, glm::vec3(rnd.uniform(-2.0f, 2.0f), rnd.uniform(-2.0f, 2.0f), rnd.uniform(-2.0f, 2.0f)));
+	}
+	bounds.refresh(matrices);
+	const double refit = bench::measure([&]() {
+		bvh.refit(bounds);
+		bench::sink = bvh.nodes[0].max.x;
+	});
+
+	uint32_t treeVisible = 0;
+	const double frustumTree = bench::measure([&]() {
+		treeVisible = 0;
+		bvh.query(bounds, frustum, [&](uint32_t) { treeVisible++; });
+	});
+	uint32_t flatVisible = 0;
+	const double frustumFlat = bench::measure([&]() {
+		flatVisible = 0;
+		for (uint32_t i = 0; i < boxCount; i++) {
+			flatVisible += frustum.classify(vkglTF::BoundingVolumeHierarchy::boxMin(bounds, i), vkglTF::BoundingVolumeHierarchy::boxMax(bounds, i)) >= 0 ? 1 : 0;
+		}
+	});
+
+	std::vector<int32_t> treeHits(rayCount), flatHits(rayCount);
+	const double raysTree = bench::measure([&]() {
+		for (uint32_t r = 0; r < rayCount; r++) {
+			float t;
+			treeHits[r] = bvh.raycast(bounds, rayOrigins[r], rayDirections[r], t);
+		}
+	}, 5);
+	const double raysFlat = bench::measure([&]() {
+		for (uint32_t r = 0; r < rayCount; r++) {
+			const glm::vec3 inverse(1.0f / rayDirections[r].x, 1.0f / rayDirections[r].y, 1.0f / rayDirections[r].z);
+			float closest = FLT_MAX;
+			flatHits[r] = -1;
+			for (uint32_t i = 0; i < boxCount; i++) {
+				float entry;
+				if (vkglTF::BoundingVolumeHierarchy::intersectRay(vkglTF::BoundingVolumeHierarchy::boxMin(bounds, i), vkglTF::BoundingVolumeHierarchy::boxMax(bounds, i), rayOrigins[r], inverse, entry) && entry < closest) {
+					closest = entry;
+					flatHits[r] = static_cast<int32_t>(i);
+				}
+			}
+		}
+	}, 3);
+
+	std::cout << "boxes: " << boxCount << ", bvh nodes: " << bvh.nodes.size() << ", rays: " << rayCount << std::endl;
+	std::cout << std::setw(10) << "build" << std::setw(12) << build << " ms" << std::endl;
+	std::cout << std::setw(10) << "refit" << std::setw(12) << refit << " ms" << std::endl;
+	std::cout << std::setw(10) << "pass" << std::setw(12) << "flat ms" << std::setw(10) << "bvh ms" << std::setw(10) << "speedup" << std::endl;
+	std::cout << std::setw(10) << "frustum" << std::setw(12) << frustumFlat << std::setw(10) << frustumTree << std::setw(10) << frustumFlat / frustumTree << std::endl;
+	std::cout << std::setw(10) << "rays" << std::setw(12) << raysFlat << std::setw(10) << raysTree << std::setw(10) << raysFlat / raysTree << std::endl;
+
+	const bool sameVisible = treeVisible == flatVisible;
+	const bool sameHits = treeHits == flatHits;
+	std::cout << "visible: " << treeVisible << " of " << boxCount << ", results match: " << (sameVisible && sameHits ? "yes" : "no") << std::endl;
+	return sameVisible && sameHits ? 0 : 1;
+}
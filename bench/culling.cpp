@@ -0,0 +1,79 @@
+/*
+* Benchmark: CPU frustum culling of a million boxes
+* Compares the scalar and AVX paths of vkglTF::CullingBounds for refreshing the world boxes and culling them
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "frustumculling.hpp"
+#include "benchutils.hpp"
+
+int main(int argc, char *argv[])
+{
+	const uint32_t boxCount = argc > 1 ? atoi(argv[1]) : 1000000;
+	const uint32_t matrixCount = 4096;
+
+	// Boxes spread over a 200 unit cube, placed by a few thousand node matrices
+	bench::Random rnd(boxCount);
+	std::vector<glm::mat4> matrices(matrixCount);
+	for (glm::mat4 &m : matrices) {
+		m = glm::translate(glm::mat4(1.0f), glm::vec3(rnd.uniform(-100.0f, 100.0f), rnd.uniform(-100.0f, 100.0f), rnd.uniform(-100.0f, 100.0f)));
+		m = glm::rotate(m, rnd.uniform(0.0f, 6.28f), glm::normalize(glm::vec3(rnd.uniform(-1.0f, 1.0f), rnd.uniform(-1.0f, 1.0f), 1.0f)));
+	}
+	vkglTF::CullingBounds bounds;
+	for (uint32_t i = 0; i < boxCount; i++) {
+		const glm::vec3 center(rnd.uniform(-5.0f, 5.0f), rnd.uniform(-5.0f, 5.0f), rnd.uniform(-5.0f, 5.0f));
+		const glm::vec3 halfSize(rnd.uniform(0.1f, 1.0f), rnd.uniform(0.1f, 1.0f), rnd.uniform(0.1f, 1.0f));
+		bounds.add(center - halfSize, center + halfSize, rnd.next() % matrixCount);
+	}
+
+	const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 256.0f);
+	const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, -120.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const vkglTF::Frustum frustum(projection * view);
+
+	std::cout << "boxes: " << boxCount << ", matrices: " << matrixCount << ", AVX: " << (vkglTF::CullingBounds::supportsAVX() ? "yes" : "no") << std::endl;
+
+	double refreshScalar = bench::measure([&]() {
+		bounds.refreshScalar(matrices);
+		bench::sink = bounds.worldMax[0][boxCount - 1];
+	});
+	double cullScalar = bench::measure([&]() {
+		bounds.cullScalar(frustum);
+		bench::sink = static_cast<float>(bounds.visible[0]);
+	});
+	const std::vector<float> scalarMin = bounds.worldMin[0];
+	const std::vector<uint64_t> scalarVisible = bounds.visible;
+
+	std::cout << std::setw(10) << "pass" << std::setw(12) << "scalar ms" << std::setw(10) << "AVX ms" << std::setw(10) << "speedup" << std::endl;
+	if (!vkglTF::CullingBounds::supportsAVX()) {
+		std::cout << std::setw(10) << "refresh" << std::setw(12) << refreshScalar << std::endl;
+		std::cout << std::setw(10) << "cull" << std::setw(12) << cullScalar << std::endl;
+		return 0;
+	}
+
+#if defined(VKGLTF_CULLING_AVX)
+	double refreshAVX = bench::measure([&]() {
+		bounds.refreshAVX(matrices);
+		bench::sink = bounds.worldMax[0][boxCount - 1];
+	});
+	double cullAVX = bench::measure([&]() {
+		bounds.cullAVX(frustum);
+		bench::sink = static_cast<float>(bounds.visible[0]);
+	});
+
+	std::cout << std::setw(10) << "refresh" << std::setw(12) << refreshScalar << std::setw(10) << refreshAVX << std::setw(10) << refreshScalar / refreshAVX << std::endl;
+	std::cout << std::setw(10) << "cull" << std::setw(12) << cullScalar << std::setw(10) << cullAVX << std::setw(10) << cullScalar / cullAVX << std::endl;
+
+	// Both paths use the same operations in the same order
+	const bool sameBoxes = scalarMin == bounds.worldMin[0];
+	const bool sameVisibility = scalarVisible == bounds.visible;
+	std::cout << "visible: " << bounds.visibleCount() << " of " << boxCount << ", results match: " << (sameBoxes && sameVisibility ? "yes" : "no") << std::endl;
+	return sameBoxes && sameVisibility ? 0 : 1;
+#endif
+}
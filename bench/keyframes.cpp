@@ -0,0 +1,105 @@
+/*
+* Benchmark: keyframe lookup on long synthetic animation clips
+* Compares the previous linear scan over all keyframes per channel with vkglTF::findKeyframe (cached cursor with
+* binary search fallback), for continuous playback and for random seeks
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+
+#include "keyframes.hpp"
+#include "benchutils.hpp"
+
+// Previous lookup in Model::updateAnimation, the last matching segment wins
+// Times are clamped to the keyframe range first, as findKeyframe does
+float linearScan(const std::vector<float> &times, float time)
+{
+	time = std::min(std::max(time, times.front()), times.back());
+	float result = 0.0f;
+	for (size_t i = 0; i < times.size() - 1; i++) {
+		if ((time >= times[i]) && (time <= times[i + 1])) {
+			result = i + (time - times[i]) / (times[i + 1] - times[i]);
+		}
+	}
+	return result;
+}
+
+float cursorLookup(const std::vector<float> &times, float time, uint32_t &cursor)
+{
+	if (!vkglTF::findKeyframe(times, time, cursor)) {
+		return 0.0f;
+	}
+	return cursor + vkglTF::keyframeFactor(times, time, cursor);
+}
+
+int main(int argc, char *argv[])
+{
+	const uint32_t channelCount = argc > 1 ? atoi(argv[1]) : 64;
+	const uint32_t frameCount = 240;
+	const uint32_t keyCounts[] = { 100, 1000, 10000, 100000 };
+
+	std::cout << "channels: " << channelCount << ", frames per run: " << frameCount << std::endl;
+	std::cout << std::setw(8) << "keys" << std::setw(14) << "scan ms" << std::setw(16) << "playback ms" << std::setw(14) << "seek ms" << std::setw(12) << "speedup" << std::setw(10) << "match" << std::endl;
+
+	for (uint32_t keyCount : keyCounts) {
+		bench::Random rnd(keyCount);
+		// Baked clips at 30 keys per second with a little jitter, one input array per channel as with separate samplers
+		std::vector<std::vector<float> > times(channelCount, std::vector<float>(keyCount));
+		for (auto &channelTimes : times) {
+			for (uint32_t k = 0; k < keyCount; k++) {
+				channelTimes[k] = k / 30.0f + rnd.uniform(0.0f, 0.01f);
+			}
+		}
+		const float duration = (keyCount - 1) / 30.0f;
+		// 60 frames per second playback starting at a random point
+		const float startTime = rnd.uniform(0.0f, std::max(duration - frameCount / 60.0f, 0.0f));
+		std::vector<float> seeks(frameCount);
+		for (auto &seek : seeks) {
+			seek = rnd.uniform(0.0f, duration);
+		}
+		std::vector<uint32_t> cursors(channelCount, 0);
+
+		bool match = true;
+		double scanTime = bench::measure([&]() {
+			float sum = 0.0f;
+			for (uint32_t f = 0; f < frameCount; f++) {
+				for (auto &channelTimes : times) {
+					sum += linearScan(channelTimes, startTime + f / 60.0f);
+				}
+			}
+			bench::sink = sum;
+		}, 3);
+		double playbackTime = bench::measure([&]() {
+			float sum = 0.0f;
+			for (uint32_t f = 0; f < frameCount; f++) {
+				for (uint32_t c = 0; c < channelCount; c++) {
+					sum += cursorLookup(times[c], startTime + f / 60.0f, cursors[c]);
+				}
+			}
+			bench::sink = sum;
+		});
+		double seekTime = bench::measure([&]() {
+			float sum = 0.0f;
+			for (uint32_t f = 0; f < frameCount; f++) {
+				for (uint32_t c = 0; c < channelCount; c++) {
+					sum += cursorLookup(times[c], seeks[f], cursors[c]);
+				}
+			}
+			bench::sink = sum;
+		});
+
+		for (uint32_t f = 0; f < frameCount && match; f++) {
+			for (uint32_t c = 0; c < channelCount && match; c++) {
+				match = linearScan(times[c], seeks[f]) == cursorLookup(times[c], seeks[f], cursors[c]);
+			}
+		}
+
+		std::cout << std::setw(8) << keyCount << std::setw(14) << scanTime << std::setw(16) << playbackTime << std::setw(14) << seekTime
+			<< std::setw(12) << scanTime / playbackTime << std::setw(10) << (match ? "yes" : "no") << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+* Benchmark: resolving glTF node indices while loading skins and animations
+* Loads synthetic scenes built in memory through vkglTF::Model (loadNodes, loadAnimations and loadSkins, which resolve
+* joints and channel targets with Model::nodeFromIndex), and compares the table lookups with the previous recursive
+* search from the root nodes over the same loaded nodes. Scenes have as many joint and channel lookups as half their
+* node count
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <stdlib.h>
+
+#include "VulkanglTFModel.hpp"
+#include "benchutils.hpp"
+
+// Previous Model::findNode, a depth first search for the node with the given glTF index
+int32_t findNode(const vkglTF::Model &model, uint32_t parent, uint32_t index)
+{
+	const vkglTF::Node &node = model.linearNodes[parent];
+	if (node.index == index) {
+		return static_cast<int32_t>(parent);
+	}
+	for (uint32_t i = node.firstChild; i < node.firstChild + node.childCount; i++) {
+		const int32_t nodeFound = findNode(model, model.nodeChildren[i], index);
+		if (nodeFound > -1) {
+			return nodeFound;
+		}
+	}
+	return -1;
+}
+
+// Previous Model::nodeFromIndex, searching each root node's tree in turn
+int32_t searchNode(const vkglTF::Model &model, uint32_t index)
+{
+	for (uint32_t root : model.nodes) {
+		const int32_t nodeFound = findNode(model, root, index);
+		if (nodeFound > -1) {
+			return nodeFound;
+		}
+	}
+	return -1;
+}
+
+/*
+	Random node tree with up to 16 roots and glTF node indices in random order, as file order and traversal order are
+	unrelated. One skin with lookupCount / 2 joints and one animation with lookupCount / 2 translation channels sharing a
+	two key sampler, both referencing random nodes
+*/
+void buildScene(uint32_t nodeCount, uint32_t lookupCount, tinygltf::Model &gltfModel, std::vector<uint32_t> &lookups)
+{
+	bench::Random rnd(nodeCount);
+
+	std::vector<uint32_t> gltfIndices(nodeCount);
+	for (uint32_t i = 0; i < nodeCount; i++) {
+		gltfIndices[i] = i;
+	}
+	for (uint32_t i = nodeCount - 1; i > 0; i--) {
+		std::swap(gltfIndices[i], gltfIndices[rnd.next() % (i + 1)]);
+	}
+
+	gltfModel.nodes.resize(nodeCount);
+	gltfModel.scenes.resize(1);
+	gltfModel.defaultScene = 0;
+	for (uint32_t i = 0; i < nodeCount; i++) {
+		if (i < 16) {
+			gltfModel.scenes[0].nodes.push_back(gltfIndices[i]);
+		} else {
+			gltfModel.nodes[gltfIndices[rnd.next() % i]].children.push_back(gltfIndices[i]);
+		}
+	}
+
+	lookups.resize(lookupCount);
+	for (uint32_t &lookup : lookups) {
+		lookup = rnd.next() % nodeCount;
+	}
+
+	// Sampler input (two times) and output (two translations) in one buffer
+	// Objects are filled in place, as copying tinygltf objects reads their uninitialized extras
+	const float samplerData[] = { 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+	gltfModel.buffers.resize(1);
+	gltfModel.buffers[0].data.resize(sizeof(samplerData));
+	memcpy(gltfModel.buffers[0].data.data(), samplerData, sizeof(samplerData));
+	gltfModel.bufferViews.resize(2);
+	gltfModel.accessors.resize(2);
+	for (int i = 0; i < 2; i++) {
+		tinygltf::BufferView &bufferView = gltfModel.bufferViews[i];
+		bufferView.buffer = 0;
+		bufferView.byteOffset = i * 2 * sizeof(float);
+		bufferView.byteLength = i == 0 ? 2 * sizeof(float) : 6 * sizeof(float);
+		tinygltf::Accessor &accessor = gltfModel.accessors[i];
+		accessor.bufferView = i;
+		accessor.byteOffset = 0;
+		accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+		accessor.type = i == 0 ? TINYGLTF_TYPE_SCALAR : TINYGLTF_TYPE_VEC3;
+		accessor.count = 2;
+	}
+
+	gltfModel.animations.resize(1);
+	gltfModel.skins.resize(1);
+	tinygltf::Animation &animation = gltfModel.animations[0];
+	animation.samplers.resize(1);
+	animation.samplers[0].input = 0;
+	animation.samplers[0].output = 1;
+	animation.samplers[0].interpolation = "LINEAR";
+	animation.channels.resize((lookupCount + 1) / 2);
+	for (uint32_t i = 0; i < lookupCount; i++) {
+		if (i % 2 == 0) {
+			tinygltf::AnimationChannel &channel = animation.channels[i / 2];
+			channel.sampler = 0;
+			channel.target_node = lookups[i];
+			channel.target_path = "translation";
+		} else {
+			gltfModel.skins[0].joints.push_back(lookups[i]);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const uint32_t maxNodeCount = argc > 1 ? atoi(argv[1]) : 50000;
+
+	std::cout << std::setw(10) << "nodes" << std::setw(10) << "lookups" << std::setw(12) << "load ms" << std::setw(14) << "search ms"
+		<< std::setw(14) << "table ms" << std::setw(12) << "speedup" << std::endl;
+
+	const uint32_t nodeCounts[] = { 1000, 5000, 10000, 50000, 100000 };
+	for (uint32_t nodeCount : nodeCounts) {
+		if (nodeCount > maxNodeCount) {
+			break;
+		}
+		tinygltf::Model gltfModel;
+		std::vector<uint32_t> lookups;
+		buildScene(nodeCount, nodeCount / 2, gltfModel, lookups);
+
+		// Loading the nodes, animation and skin through the model, including building the table and all lookups
+		vkglTF::Model model;
+		double loadTime = bench::measure([&]() {
+			model = vkglTF::Model();
+			std::vector<uint32_t> indexBuffer;
+			std::vector<vkglTF::Model::Vertex> vertexBuffer;
+			model.loadNodes(gltfModel, indexBuffer, vertexBuffer, 1.0f);
+			model.loadAnimations(gltfModel);
+			model.loadSkins(gltfModel);
+			bench::sink = static_cast<float>(model.joints.size() + model.animations[0].channels.size());
+		}, 3);
+		if (model.linearNodes.size() != nodeCount || model.joints.size() + model.animations[0].channels.size() != lookups.size()) {
+			std::cout << "Not all nodes or lookups were resolved while loading" << std::endl;
+			return 1;
+		}
+
+		// The old search is quadratic, so it is only run once
+		std::vector<int32_t> searched(lookups.size());
+		double searchTime = bench::measure([&]() {
+			for (size_t i = 0; i < lookups.size(); i++) {
+				searched[i] = searchNode(model, lookups[i]);
+			}
+		}, 1);
+
+		std::vector<int32_t> resolved(lookups.size());
+		double tableTime = bench::measure([&]() {
+			for (size_t i = 0; i < lookups.size(); i++) {
+				resolved[i] = model.nodeFromIndex(lookups[i]);
+			}
+		});
+		if (resolved != searched) {
+			std::cout << "Table and search resolved different nodes" << std::endl;
+			return 1;
+		}
+
+		std::cout << std::setw(10) << nodeCount << std::setw(10) << lookups.size() << std::setw(12) << loadTime << std::setw(14) << searchTime
+			<< std::setw(14) << tableTime << std::setw(12) << searchTime / tableTime << std::endl;
+	}
+
+	return 0;
+}
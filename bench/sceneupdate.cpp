@@ -0,0 +1,116 @@
+/*
+* Benchmark: scaling of the per-frame scene update over a thread pool
+* Full world matrix pass over vkglTF::TransformHierarchy plus one joint palette per character, as done by
+* vkglTF::Model::updateNodes, for 1 to N threads. Results are checked to be identical to the single threaded update
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <string.h>
+
+#include "transformhierarchy.hpp"
+#include "threadpool.hpp"
+#include "benchutils.hpp"
+
+struct Character {
+	std::vector<uint32_t> joints;
+	std::vector<glm::mat4> inverseBindMatrices;
+	size_t paletteOffset;
+};
+
+/*
+	A scene root with characterCount characters of jointCount joints each (a spine chain with a limb branching off every
+	fourth joint) and propCount static single node props, in pre-order
+*/
+void buildScene(uint32_t characterCount, uint32_t jointCount, uint32_t propCount, vkglTF::TransformHierarchy &hierarchy, std::vector<Character> &characters)
+{
+	bench::Random rnd(characterCount * 131 + jointCount);
+	auto randomNode = [&](int32_t parent) {
+		glm::vec3 t(rnd.uniform(-1.0f, 1.0f), rnd.uniform(-1.0f, 1.0f), rnd.uniform(-1.0f, 1.0f));
+		glm::quat r = glm::normalize(glm::quat(rnd.uniform(), rnd.uniform(-0.1f, 0.1f), rnd.uniform(-0.1f, 0.1f), rnd.uniform(-0.1f, 0.1f)));
+		return hierarchy.add(parent, t, r, glm::vec3(1.0f));
+	};
+	hierarchy.clear();
+	characters.assign(characterCount, Character());
+	const int32_t root = randomNode(-1);
+	size_t paletteOffset = 0;
+	for (auto &character : characters) {
+		int32_t spine = randomNode(root);
+		character.joints.push_back(spine);
+		while (character.joints.size() < jointCount) {
+			if (character.joints.size() % 4 == 0) {
+				character.joints.push_back(randomNode(spine));
+			} else {
+				spine = randomNode(spine);
+				character.joints.push_back(spine);
+			}
+		}
+		character.inverseBindMatrices.assign(jointCount, glm::mat4(1.0f));
+		character.paletteOffset = paletteOffset;
+		paletteOffset += jointCount;
+	}
+	for (uint32_t i = 0; i < propCount; i++) {
+		randomNode(root);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const uint32_t characterCount = argc > 1 ? atoi(argv[1]) : 256;
+	const uint32_t jointCount = argc > 2 ? atoi(argv[2]) : 64;
+	const uint32_t propCount = argc > 3 ? atoi(argv[3]) : 32768;
+	const uint32_t maxThreads = argc > 4 ? atoi(argv[4]) : std::max(4u, std::thread::hardware_concurrency());
+
+	vkglTF::TransformHierarchy hierarchy;
+	std::vector<Character> characters;
+	buildScene(characterCount, jointCount, propCount, hierarchy, characters);
+	std::vector<glm::mat4> palettes(characterCount * jointCount);
+
+	std::cout << "nodes: " << hierarchy.size() << ", characters: " << characterCount << " x " << jointCount << " joints"
+		<< ", hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+	std::cout << std::setw(8) << "threads" << std::setw(12) << "update ms" << std::setw(10) << "speedup" << std::setw(12) << "identical" << std::endl;
+
+	std::vector<glm::mat4> referenceWorld;
+	std::vector<glm::mat4> referencePalettes;
+	double serialTime = 0.0;
+	for (uint32_t threads = 1; threads <= maxThreads; threads *= 2) {
+		vks::ThreadPool pool(threads - 1);
+		vks::ThreadPool *updatePool = threads > 1 ? &pool : nullptr;
+		auto updatePalette = [&](size_t index) {
+			const Character &character = characters[index];
+			for (size_t i = 0; i < character.joints.size(); i++) {
+				palettes[character.paletteOffset + i] = hierarchy.worldMatrices[character.joints[i]] * character.inverseBindMatrices[i];
+			}
+		};
+
+		double time = bench::measure([&]() {
+			hierarchy.update(updatePool);
+			if (updatePool) {
+				updatePool->parallelFor(characters.size(), updatePalette);
+			} else {
+				for (size_t i = 0; i < characters.size(); i++) {
+					updatePalette(i);
+				}
+			}
+			bench::sink = palettes.back()[3][0];
+		});
+
+		bool identical = true;
+		if (threads == 1) {
+			serialTime = time;
+			referenceWorld = hierarchy.worldMatrices;
+			referencePalettes = palettes;
+		} else {
+			identical = memcmp(referenceWorld.data(), hierarchy.worldMatrices.data(), referenceWorld.size() * sizeof(glm::mat4)) == 0
+				&& memcmp(referencePalettes.data(), palettes.data(), palettes.size() * sizeof(glm::mat4)) == 0;
+		}
+
+		std::cout << std::setw(8) << threads << std::setw(12) << time << std::setw(10) << serialTime / time
+			<< std::setw(12) << (identical ? "yes" : "no") << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+* Benchmark: world matrix update of deep synthetic node hierarchies
+* Compares walking the parent chain per node (the old Node::getMatrix) with the linear pass over vkglTF::TransformHierarchy,
+* and a full pass with the dirty-subtree update when a single prop is animated
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <cmath>
+
+#include "transformhierarchy.hpp"
+#include "benchutils.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+// Pointer based node equivalent to the previous vkglTF::Node transform code
+struct PointerNode {
+	PointerNode *parent = nullptr;
+	glm::vec3 translation;
+	glm::quat rotation;
+	glm::vec3 scale;
+
+	glm::mat4 localMatrix() const
+	{
+		return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale);
+	}
+
+	glm::mat4 getMatrix() const
+	{
+		glm::mat4 m = localMatrix();
+		const PointerNode *p = parent;
+		while (p) {
+			m = p->localMatrix() * m;
+			p = p->parent;
+		}
+		return m;
+	}
+};
+
+/*
+	Builds nodeCount nodes as a forest of chains with the given depth, in pre-order
+*/
+void buildScene(uint32_t nodeCount, uint32_t depth, vkglTF::TransformHierarchy &hierarchy, std::vector<PointerNode> &pointerNodes)
+{
+	bench::Random rnd(nodeCount * 31 + depth);
+	hierarchy.clear();
+	pointerNodes.assign(nodeCount, PointerNode());
+	for (uint32_t i = 0; i < nodeCount; i++) {
+		const int32_t parent = (i % depth == 0) ? -1 : static_cast<int32_t>(i - 1);
+		glm::vec3 t(rnd.uniform(-1.0f, 1.0f), rnd.uniform(-1.0f, 1.0f), rnd.uniform(-1.0f, 1.0f));
+		glm::quat r = glm::normalize(glm::quat(rnd.uniform(), rnd.uniform(-0.1f, 0.1f), rnd.uniform(-0.1f, 0.1f), rnd.uniform(-0.1f, 0.1f)));
+		glm::vec3 s(rnd.uniform(0.99f, 1.01f));
+		hierarchy.add(parent, t, r, s);
+		pointerNodes[i].parent = parent < 0 ? nullptr : &pointerNodes[parent];
+		pointerNodes[i].translation = t;
+		pointerNodes[i].rotation = r;
+		pointerNodes[i].scale = s;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const uint32_t nodeCount = argc > 1 ? atoi(argv[1]) : 16384;
+	const uint32_t depths[] = { 1, 4, 16, 64, 256 };
+
+	std::vector<PointerNode> pointerNodes;
+	std::vector<glm::mat4> pointerWorld(nodeCount);
+	vkglTF::TransformHierarchy hierarchy;
+
+	std::cout << "nodes: " << nodeCount << std::endl;
+	std::cout << std::setw(8) << "depth" << std::setw(16) << "parent walk ms" << std::setw(14) << "flat pass ms" << std::setw(10) << "speedup" << std::setw(14) << "max error" << std::endl;
+
+	for (uint32_t depth : depths) {
+		buildScene(nodeCount, depth, hierarchy, pointerNodes);
+
+		double walkTime = bench::measure([&]() {
+			for (uint32_t i = 0; i < nodeCount; i++) {
+				pointerWorld[i] = pointerNodes[i].getMatrix();
+			}
+			bench::sink = pointerWorld[nodeCount - 1][3][0];
+		});
+		double flatTime = bench::measure([&]() {
+			hierarchy.update();
+			bench::sink = hierarchy.worldMatrices[nodeCount - 1][3][0];
+		});
+
+		float maxError = 0.0f;
+		for (uint32_t i = 0; i < nodeCount; i++) {
+			for (int c = 0; c < 4; c++) {
+				glm::vec4 d = glm::abs(pointerWorld[i][c] - hierarchy.worldMatrices[i][c]);
+				maxError = std::max(maxError, std::max(std::max(d.x, d.y), std::max(d.z, d.w)));
+			}
+		}
+
+		std::cout << std::setw(8) << depth << std::setw(16) << walkTime << std::setw(14) << flatTime
+			<< std::setw(10) << walkTime / flatTime << std::setw(14) << maxError << std::endl;
+	}
+
+	// Mostly static scene: one animated prop (a root with a subtree of 16 nodes) per update
+	const uint32_t propDepth = 16;
+	buildScene(nodeCount, propDepth, hierarchy, pointerNodes);
+	hierarchy.update();
+	const uint32_t prop = (nodeCount / propDepth / 2) * propDepth;
+	float angle = 0.0f;
+	double fullTime = bench::measure([&]() {
+		angle += 0.01f;
+		hierarchy.rotations[prop] = glm::quat(std::cos(angle), 0.0f, std::sin(angle), 0.0f);
+		hierarchy.update();
+		bench::sink = hierarchy.worldMatrices[prop][3][0];
+	});
+	double dirtyTime = bench::measure([&]() {
+		angle += 0.01f;
+		hierarchy.rotations[prop] = glm::quat(std::cos(angle), 0.0f, std::sin(angle), 0.0f);
+		hierarchy.markDirty(prop);
+		hierarchy.updateDirty();
+		bench::sink = hierarchy.worldMatrices[prop][3][0];
+	});
+	std::cout << std::endl << "single animated prop: full pass " << fullTime * 1000.0 << " us, dirty subtree " << dirtyTime * 1000.0 << " us" << std::endl;
+
+	return 0;
+}
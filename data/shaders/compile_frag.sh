@@ -1,2 +1,21 @@
 #!/bin/bash
-glslangValidator -V -o pbr_khr.frag.spv pbr_khr.frag
+# Builds the SPIR-V of every shader variant next to its source, also run by the CMake build when glslangValidator is found
+set -e
+cd "$(dirname "$0")"
+GLSLANG_VALIDATOR=${GLSLANG_VALIDATOR:-glslangValidator}
+$GLSLANG_VALIDATOR -V -o pbr_khr.frag.spv pbr_khr.frag
+$GLSLANG_VALIDATOR -V -o pbr.vert.spv pbr.vert
+$GLSLANG_VALIDATOR -V -DINDIRECT_DRAW -o pbr_khr_indirect.frag.spv pbr_khr.frag
+$GLSLANG_VALIDATOR -V -DINDIRECT_DRAW -DBINDLESS -o pbr_khr_bindless.frag.spv pbr_khr.frag
+$GLSLANG_VALIDATOR -V -DINDIRECT_DRAW -o pbr_indirect.vert.spv pbr.vert
+$GLSLANG_VALIDATOR -V -DDEPTH_ONLY -o pbr_depth.vert.spv pbr.vert
+$GLSLANG_VALIDATOR -V -DDEPTH_ONLY -DALPHA_MASK -o pbr_depth_mask.vert.spv pbr.vert
+$GLSLANG_VALIDATOR -V -DDEPTH_ONLY -DINDIRECT_DRAW -o pbr_depth_indirect.vert.spv pbr.vert
+$GLSLANG_VALIDATOR -V -DDEPTH_ONLY -DALPHA_MASK -DINDIRECT_DRAW -o pbr_depth_mask_indirect.vert.spv pbr.vert
+$GLSLANG_VALIDATOR -V -DDEPTH_ONLY -o pbr_khr_depth_mask.frag.spv pbr_khr.frag
+$GLSLANG_VALIDATOR -V -DDEPTH_ONLY -DINDIRECT_DRAW -o pbr_khr_depth_mask_indirect.frag.spv pbr_khr.frag
+$GLSLANG_VALIDATOR -V -DDEPTH_ONLY -DINDIRECT_DRAW -DBINDLESS -o pbr_khr_depth_mask_bindless.frag.spv pbr_khr.frag
+$GLSLANG_VALIDATOR -V -o deform.comp.spv deform.comp
+$GLSLANG_VALIDATOR -V -o cull.comp.spv cull.comp
+$GLSLANG_VALIDATOR -V -DOCCLUSION -o cull_occlusion.comp.spv cull.comp
+$GLSLANG_VALIDATOR -V -o depthpyramid.comp.spv depthpyramid.comp
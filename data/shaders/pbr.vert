@@ -1,9 +1,14 @@
 #version 450
 
+// DEPTH_ONLY is the depth pre-pass variant, reading only positions (and UVs for ALPHA_MASK) besides the skin inputs
 layout (location = 0) in vec3 inPos;
+#ifndef DEPTH_ONLY
 layout (location = 1) in vec3 inNormal;
+#endif
+#if !defined(DEPTH_ONLY) || defined(ALPHA_MASK)
 layout (location = 2) in vec2 inUV0;
 layout (location = 3) in vec2 inUV1;
+#endif
 layout (location = 4) in vec4 inJoint0;
 layout (location = 5) in vec4 inWeight0;
 
@@ -15,46 +20,104 @@ layout (set = 0, binding = 0) uniform UBO
 	vec3 camPos;
 } ubo;
 
-#define MAX_NUM_JOINTS 128
+#ifdef INDIRECT_DRAW
+struct DrawData {
+	uint nodeBlock;
+	uint material;
+};
+
+// Indexed with the draw's firstInstance, set to its position in the draw list
+layout (set = 2, binding = 2) readonly buffer Draws {
+	DrawData draws[];
+};
+
+// The node buffer of set 2 binding 0 viewed as vec4s, a block starts at draw.nodeBlock
+layout (set = 2, binding = 3) readonly buffer NodeBlocks {
+	vec4 nodeData[];
+};
+
+#if !defined(DEPTH_ONLY) || defined(ALPHA_MASK)
+layout (location = 4) flat out uint outMaterial;
+#endif
 
+struct Node {
+	mat4 matrix;
+	float jointCount;
+	uint jointOffset;
+} node;
+#else
+// Selected per mesh with a dynamic offset
 layout (set = 2, binding = 0) uniform UBONode {
 	mat4 matrix;
-	mat4 jointMatrix[MAX_NUM_JOINTS];
 	float jointCount;
+	uint jointOffset;
 } node;
+#endif
 
+// Joint palettes of all skins, the palette of this mesh's skin starts at node.jointOffset
+layout (set = 2, binding = 1) readonly buffer JointMatrices {
+	mat4 jointMatrix[];
+};
+
+#ifndef DEPTH_ONLY
 layout (location = 0) out vec3 outWorldPos;
 layout (location = 1) out vec3 outNormal;
+#endif
+#if !defined(DEPTH_ONLY) || defined(ALPHA_MASK)
 layout (location = 2) out vec2 outUV0;
 layout (location = 3) out vec2 outUV1;
+#endif
 // layout (location = 4) out vec4 outNormPos;
 
+// Invariant so the depth pre-pass and the main pass, which tests for equal depth, compute the same positions
 out gl_PerVertex
 {
-	vec4 gl_Position;
+	invariant vec4 gl_Position;
 };
 
 void main() 
 {
+#ifdef INDIRECT_DRAW
+	DrawData draw = draws[gl_InstanceIndex];
+	uint block = draw.nodeBlock;
+	node.matrix = mat4(nodeData[block], nodeData[block + 1], nodeData[block + 2], nodeData[block + 3]);
+	node.jointCount = nodeData[block + 4].x;
+	node.jointOffset = floatBitsToUint(nodeData[block + 4].y);
+#if !defined(DEPTH_ONLY) || defined(ALPHA_MASK)
+	outMaterial = draw.material;
+#endif
+#endif
+
 	vec4 locPos;
 	if (node.jointCount > 0.0) {
 		// Mesh is skinned
 		mat4 skinMat = 
-			inWeight0.x * node.jointMatrix[int(inJoint0.x)] +
-			inWeight0.y * node.jointMatrix[int(inJoint0.y)] +
-			inWeight0.z * node.jointMatrix[int(inJoint0.z)] +
-			inWeight0.w * node.jointMatrix[int(inJoint0.w)];
+			inWeight0.x * jointMatrix[node.jointOffset + uint(inJoint0.x)] +
+			inWeight0.y * jointMatrix[node.jointOffset + uint(inJoint0.y)] +
+			inWeight0.z * jointMatrix[node.jointOffset + uint(inJoint0.z)] +
+			inWeight0.w * jointMatrix[node.jointOffset + uint(inJoint0.w)];
 
-		locPos = ubo.model * node.matrix * skinMat * vec4(inPos, 1.0);
-		outNormal = normalize(transpose(inverse(mat3(ubo.model * node.matrix * skinMat))) * inNormal);
+		// Joint palettes are shared per skin and already in model space: the mesh-relative correction
+		// inverse(node.matrix) cancels against node.matrix, so the node matrix is not applied here
+		locPos = ubo.model * skinMat * vec4(inPos, 1.0);
+#ifndef DEPTH_ONLY
+		outNormal = normalize(transpose(inverse(mat3(ubo.model * skinMat))) * inNormal);
+#endif
 	} else {
 		locPos = ubo.model * node.matrix * vec4(inPos, 1.0);
+#ifndef DEPTH_ONLY
 		outNormal = normalize(transpose(inverse(mat3(ubo.model * node.matrix))) * inNormal);
+#endif
 	}
-	outWorldPos = locPos.xyz / locPos.w;
-	vec4 projPos = ubo.projection * ubo.view * vec4(outWorldPos, 1.0);
+	vec3 worldPos = locPos.xyz / locPos.w;
+	vec4 projPos = ubo.projection * ubo.view * vec4(worldPos, 1.0);
+#ifndef DEPTH_ONLY
+	outWorldPos = worldPos;
+#endif
+#if !defined(DEPTH_ONLY) || defined(ALPHA_MASK)
 	outUV0 = inUV0;
 	outUV1 = inUV1;
+#endif
 	gl_Position =  projPos;
 	// outNormPos = projPos;
 }
@@ -35,12 +35,58 @@ layout (set = 0, binding = 4) uniform sampler2D samplerBRDFLUT;
 
 // Material bindings
 
+#ifdef BINDLESS
+// All textures of the model, element 0 is the empty texture used by unset material slots
+layout (constant_id = 0) const uint TEXTURE_COUNT = 1;
+layout (set = 1, binding = 0) uniform sampler2D textures[TEXTURE_COUNT];
+
+// The material index is the same for all fragments of a draw, so these are dynamically uniform
+#define colorMap textures[material.colorTexture]
+#define physicalDescriptorMap textures[material.physicalDescriptorTexture]
+#define normalMap textures[material.normalTexture]
+#define aoMap textures[material.occlusionTexture]
+#define emissiveMap textures[material.emissiveTexture]
+#else
 layout (set = 1, binding = 0) uniform sampler2D colorMap;
 layout (set = 1, binding = 1) uniform sampler2D physicalDescriptorMap;
 layout (set = 1, binding = 2) uniform sampler2D normalMap;
 layout (set = 1, binding = 3) uniform sampler2D aoMap;
 layout (set = 1, binding = 4) uniform sampler2D emissiveMap;
+#endif
 
+#ifdef INDIRECT_DRAW
+struct Material {
+	vec4 baseColorFactor;
+	vec4 emissiveFactor;
+	vec4 diffuseFactor;
+	vec4 specularFactor;
+	float workflow;
+	int baseColorTextureSet;
+	int physicalDescriptorTextureSet;
+	int normalTextureSet;
+	int occlusionTextureSet;
+	int emissiveTextureSet;
+	float metallicFactor;
+	float roughnessFactor;
+	float alphaMask;
+	float alphaMaskCutoff;
+	// Indices into textures[] of bindless pipelines
+	int colorTexture;
+	int physicalDescriptorTexture;
+	int normalTexture;
+	int occlusionTexture;
+	int emissiveTexture;
+};
+
+// Parameters of all materials, selected by the material index passed down from the draw data
+layout (set = 2, binding = 4) readonly buffer Materials {
+	Material materials[];
+};
+
+layout (location = 4) flat in uint inMaterial;
+
+#define material materials[inMaterial]
+#else
 layout (push_constant) uniform Material {
 	vec4 baseColorFactor;
 	vec4 emissiveFactor;
@@ -57,9 +103,36 @@ layout (push_constant) uniform Material {
 	float alphaMask;	
 	float alphaMaskCutoff;
 } material;
+#endif
 
 layout (location = 0) out vec4 outColor;
 
+// Feature buffer output of the pipeline: 0 runs the full shader and selects the output with uboParams.debugViewEquation,
+// the others write the same as the matching debugViewEquation case without evaluating the lighting
+layout (constant_id = 1) const int FEATURE = 0;
+#define FEATURE_NORMAL 1
+#define FEATURE_ALBEDO 2
+#define FEATURE_POSITION 3
+
+// Material permutation the pipeline is specialized for, see vkglTF::Material::permutation
+// PERMUTATION_DYNAMIC reads the texture sets, workflow and alpha mode of the material at runtime instead,
+// the others fold them to constants so unused texture fetches and workflow branches are compiled out
+layout (constant_id = 2) const uint PERMUTATION = 0xFFFFFFFFu;
+#define PERMUTATION_DYNAMIC 0xFFFFFFFFu
+
+int textureSet(int materialSet, uint shift)
+{
+	return PERMUTATION == PERMUTATION_DYNAMIC ? materialSet : int((PERMUTATION >> shift) & 3u) - 1;
+}
+
+#define COLOR_SET textureSet(material.baseColorTextureSet, 0u)
+#define PHYSICAL_DESCRIPTOR_SET textureSet(material.physicalDescriptorTextureSet, 2u)
+#define NORMAL_SET textureSet(material.normalTextureSet, 4u)
+#define OCCLUSION_SET textureSet(material.occlusionTextureSet, 6u)
+#define EMISSIVE_SET textureSet(material.emissiveTextureSet, 8u)
+#define MATERIAL_WORKFLOW (PERMUTATION == PERMUTATION_DYNAMIC ? material.workflow : float((PERMUTATION >> 10) & 1u))
+#define MATERIAL_ALPHA_MASK (PERMUTATION == PERMUTATION_DYNAMIC ? material.alphaMask : float((PERMUTATION >> 11) & 1u))
+
 // Encapsulate the various inputs used by the various functions in the shading equation
 // We store values in this struct to simplify the integration of alternative implementations
 // of the shading terms, outlined in the Readme.MD Appendix.
@@ -126,7 +199,7 @@ vec4 SRGBtoLINEAR(vec4 srgbIn)
 vec3 getNormal()
 {
 	// Perturb normal, see http://www.thetenthplanet.de/archives/1180
-	vec3 tangentNormal = texture(normalMap, material.normalTextureSet == 0 ? inUV0 : inUV1).xyz * 2.0 - 1.0;
+	vec3 tangentNormal = texture(normalMap, NORMAL_SET == 0 ? inUV0 : inUV1).xyz * 2.0 - 1.0;
 
 	vec3 q1 = dFdx(inWorldPos);
 	vec3 q2 = dFdy(inWorldPos);
@@ -218,6 +291,52 @@ float convertMetallic(vec3 diffuse, vec3 specular, float maxSpecular) {
 	return clamp((-b + sqrt(D)) / (2.0 * a), 0.0, 1.0);
 }
 
+#ifndef DEPTH_ONLY
+// Output of a feature pipeline, alpha is the lit output's for feature outputs that keep it
+vec4 featureOutput()
+{
+	if (FEATURE == FEATURE_ALBEDO) {
+		vec4 albedo = COLOR_SET > -1 ? texture(colorMap, COLOR_SET == 0 ? inUV0 : inUV1) : vec4(1.0f);
+		return SRGBtoLINEAR(albedo) * material.baseColorFactor;
+	}
+	float alpha;
+	if (MATERIAL_WORKFLOW == PBR_WORKFLOW_SPECULAR_GLOSINESS) {
+		alpha = texture(colorMap, inUV0).a;
+	} else if (COLOR_SET > -1) {
+		alpha = texture(colorMap, COLOR_SET == 0 ? inUV0 : inUV1).a * material.baseColorFactor.a;
+	} else {
+		alpha = material.baseColorFactor.a;
+	}
+	if (FEATURE == FEATURE_NORMAL) {
+		return vec4((NORMAL_SET > -1) ? getNormal() : normalize(inNormal), alpha);
+	}
+	return vec4(inWorldPos, alpha);
+}
+#endif
+
+// Discard fragments of alpha masked materials below their cutoff
+void alphaMaskTest()
+{
+	if (MATERIAL_ALPHA_MASK == 1.0f) {
+		vec4 baseColor;
+		if (COLOR_SET > -1) {
+			baseColor = SRGBtoLINEAR(texture(colorMap, COLOR_SET == 0 ? inUV0 : inUV1)) * material.baseColorFactor;
+		} else {
+			baseColor = material.baseColorFactor;
+		}
+		if (baseColor.a < material.alphaMaskCutoff) {
+			discard;
+		}
+	}
+}
+
+#ifdef DEPTH_ONLY
+// Alpha tested depth pre-pass of masked materials, nothing but the mask is evaluated
+void main()
+{
+	alphaMaskTest();
+}
+#else
 void main()
 {
 	float perceptualRoughness;
@@ -227,27 +346,23 @@ void main()
 
 	vec3 f0 = vec3(0.04);
 
-	if (material.alphaMask == 1.0f) {
-		if (material.baseColorTextureSet > -1) {
-			baseColor = SRGBtoLINEAR(texture(colorMap, material.baseColorTextureSet == 0 ? inUV0 : inUV1)) * material.baseColorFactor;
-		} else {
-			baseColor = material.baseColorFactor;
-		}
-		if (baseColor.a < material.alphaMaskCutoff) {
-			discard;
-		}
+	alphaMaskTest();
+
+	if (FEATURE != 0) {
+		outColor = featureOutput();
+		return;
 	}
 
-	if (material.workflow == PBR_WORKFLOW_METALLIC_ROUGHNESS) {
+	if (MATERIAL_WORKFLOW == PBR_WORKFLOW_METALLIC_ROUGHNESS) {
 		// Metallic and Roughness material properties are packed together
 		// In glTF, these factors can be specified by fixed scalar values
 		// or from a metallic-roughness map
 		perceptualRoughness = material.roughnessFactor;
 		metallic = material.metallicFactor;
-		if (material.physicalDescriptorTextureSet > -1) {
+		if (PHYSICAL_DESCRIPTOR_SET > -1) {
 			// Roughness is stored in the 'g' channel, metallic is stored in the 'b' channel.
 			// This layout intentionally reserves the 'r' channel for (optional) occlusion map data
-			vec4 mrSample = texture(physicalDescriptorMap, material.physicalDescriptorTextureSet == 0 ? inUV0 : inUV1);
+			vec4 mrSample = texture(physicalDescriptorMap, PHYSICAL_DESCRIPTOR_SET == 0 ? inUV0 : inUV1);
 			perceptualRoughness = mrSample.g * perceptualRoughness;
 			metallic = mrSample.b * metallic;
 		} else {
@@ -258,17 +373,17 @@ void main()
 		// convert to material roughness by squaring the perceptual roughness [2].
 
 		// The albedo may be defined from a base texture or a flat color
-		if (material.baseColorTextureSet > -1) {
-			baseColor = SRGBtoLINEAR(texture(colorMap, material.baseColorTextureSet == 0 ? inUV0 : inUV1)) * material.baseColorFactor;
+		if (COLOR_SET > -1) {
+			baseColor = SRGBtoLINEAR(texture(colorMap, COLOR_SET == 0 ? inUV0 : inUV1)) * material.baseColorFactor;
 		} else {
 			baseColor = material.baseColorFactor;
 		}
 	}
 
-	if (material.workflow == PBR_WORKFLOW_SPECULAR_GLOSINESS) {
+	if (MATERIAL_WORKFLOW == PBR_WORKFLOW_SPECULAR_GLOSINESS) {
 		// Values from specular glossiness workflow are converted to metallic roughness
-		if (material.physicalDescriptorTextureSet > -1) {
-			perceptualRoughness = 1.0 - texture(physicalDescriptorMap, material.physicalDescriptorTextureSet == 0 ? inUV0 : inUV1).a;
+		if (PHYSICAL_DESCRIPTOR_SET > -1) {
+			perceptualRoughness = 1.0 - texture(physicalDescriptorMap, PHYSICAL_DESCRIPTOR_SET == 0 ? inUV0 : inUV1).a;
 		} else {
 			perceptualRoughness = 0.0;
 		}
@@ -305,7 +420,7 @@ void main()
 	vec3 specularEnvironmentR0 = specularColor.rgb;
 	vec3 specularEnvironmentR90 = vec3(1.0, 1.0, 1.0) * reflectance90;
 
-	vec3 n = (material.normalTextureSet > -1) ? getNormal() : normalize(inNormal);
+	vec3 n = (NORMAL_SET > -1) ? getNormal() : normalize(inNormal);
 	vec3 v = normalize(ubo.camPos - inWorldPos);    // Vector from surface point to camera
 	vec3 l = normalize(uboParams.lightDir.xyz);     // Vector from surface point to light
 	vec3 h = normalize(l+v);                        // Half vector between both l and v
@@ -351,14 +466,14 @@ void main()
 
 	const float u_OcclusionStrength = 1.0f;
 	// Apply optional PBR terms for additional (optional) shading
-	if (material.occlusionTextureSet > -1) {
-		float ao = texture(aoMap, (material.occlusionTextureSet == 0 ? inUV0 : inUV1)).r;
+	if (OCCLUSION_SET > -1) {
+		float ao = texture(aoMap, (OCCLUSION_SET == 0 ? inUV0 : inUV1)).r;
 		color = mix(color, color * ao, u_OcclusionStrength);
 	}
 
 	const float u_EmissiveFactor = 1.0f;
-	if (material.emissiveTextureSet > -1) {
-		vec3 emissive = SRGBtoLINEAR(texture(emissiveMap, material.emissiveTextureSet == 0 ? inUV0 : inUV1)).rgb * u_EmissiveFactor;
+	if (EMISSIVE_SET > -1) {
+		vec3 emissive = SRGBtoLINEAR(texture(emissiveMap, EMISSIVE_SET == 0 ? inUV0 : inUV1)).rgb * u_EmissiveFactor;
 		color += emissive;
 	}
 	
@@ -369,16 +484,16 @@ void main()
 		int index = int(uboParams.debugViewInputs);
 		switch (index) {
 			case 1:
-				outColor.rgba = material.baseColorTextureSet > -1 ? texture(colorMap, material.baseColorTextureSet == 0 ? inUV0 : inUV1) : vec4(1.0f);
+				outColor.rgba = COLOR_SET > -1 ? texture(colorMap, COLOR_SET == 0 ? inUV0 : inUV1) : vec4(1.0f);
 				break;
 			case 2:
-				outColor.rgb = (material.normalTextureSet > -1) ? texture(normalMap, material.normalTextureSet == 0 ? inUV0 : inUV1).rgb : normalize(inNormal);
+				outColor.rgb = (NORMAL_SET > -1) ? texture(normalMap, NORMAL_SET == 0 ? inUV0 : inUV1).rgb : normalize(inNormal);
 				break;
 			case 3:
-				outColor.rgb = (material.occlusionTextureSet > -1) ? texture(aoMap, material.occlusionTextureSet == 0 ? inUV0 : inUV1).rrr : vec3(0.0f);
+				outColor.rgb = (OCCLUSION_SET > -1) ? texture(aoMap, OCCLUSION_SET == 0 ? inUV0 : inUV1).rrr : vec3(0.0f);
 				break;
 			case 4:
-				outColor.rgb = (material.emissiveTextureSet > -1) ? texture(emissiveMap, material.emissiveTextureSet == 0 ? inUV0 : inUV1).rgb : vec3(0.0f);
+				outColor.rgb = (EMISSIVE_SET > -1) ? texture(emissiveMap, EMISSIVE_SET == 0 ? inUV0 : inUV1).rgb : vec3(0.0f);
 				break;
 			case 5:
 				outColor.rgb = texture(physicalDescriptorMap, inUV0).bbb;
@@ -408,7 +523,7 @@ void main()
 		  break;
 		case 2:
 		  // outColor.rgb = inWorldPos;
-		  outColor.rgba = material.baseColorTextureSet > -1 ? texture(colorMap, material.baseColorTextureSet == 0 ? inUV0 : inUV1) : vec4(1.0f);  outColor = SRGBtoLINEAR(outColor) * material.baseColorFactor;
+		  outColor.rgba = COLOR_SET > -1 ? texture(colorMap, COLOR_SET == 0 ? inUV0 : inUV1) : vec4(1.0f);  outColor = SRGBtoLINEAR(outColor) * material.baseColorFactor;
 		  // outColor.rgb = baseColor.rgb;
 		  // outColor.rgb = diffuseColor.rgb;
 		  // outColor.rgb = vec3(1.0, 0.0, 0.0);
@@ -435,3 +550,4 @@ void main()
 	}
 
 }
+#endif
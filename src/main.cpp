@@ -23,6 +23,9 @@
 #include <vector>
 #include <chrono>
 #include <map>
+#include <memory>
+#include <cmath>
+#include <cstddef>
 #include "algorithm"
 
 #include "unistd.h"
@@ -40,6 +43,7 @@
 #include "VulkanTexture.hpp"
 #include "VulkanglTFModel.hpp"
 #include "VulkanUtils.hpp"
+#include "threadpool.hpp"
 
 #ifdef WITH_DISPLAY
 #include "ui.hpp"
@@ -131,9 +135,100 @@ void output_image_float(float* data, int width, int height, int channels, const
   out->close();
 }
 
-/* void output_image_uint8(float* data, int width, int height, const std::string& file_name) {
-  
-   } */
+// Pick a preview mapping that makes sense for the given feature buffer
+std::string preview_mode_for_feature(const std::string& mode, const std::string& feature) {
+  if(mode != "auto") {
+    return mode;
+  }
+  if(feature == "normal") {
+    return "signed";
+  } else if(feature == "albedo") {
+    return "clamp";
+  } else if(feature == "position") {
+    return "normalize";
+  }
+  return "tonemap";
+}
+
+/*
+  Write a 3-channel float image as an 8-bit PNG or JPEG, box-filtered down by an integer factor
+  Modes: tonemap (Reinhard + gamma, for HDR color), normalize (per-channel min/max),
+  clamp (clamp to [0, 1] + gamma) and signed (maps [-1, 1] to [0, 1], for normals)
+*/
+void output_image_preview(const float* data, int width, int height, int downscale, const std::string& mode,
+			  const std::string& format, int quality, const std::string& file_name) {
+  const int out_width = std::max(1, width / downscale);
+  const int out_height = std::max(1, height / downscale);
+  const int box_width = std::min(downscale, width);
+  const int box_height = std::min(downscale, height);
+  const float inv_area = 1.0f / (box_width * box_height);
+
+  // Downscale while flipping vertically, to match the orientation of output_image_float
+  std::vector<float> small(out_width * out_height * 3);
+  for(int y = 0; y < out_height; y++) {
+    for(int x = 0; x < out_width; x++) {
+      float sum[3] = {0.0f, 0.0f, 0.0f};
+      for(int dy = 0; dy < box_height; dy++) {
+	const float* row = data + 3 * width * (height - 1 - (y * box_height + dy));
+	for(int dx = 0; dx < box_width; dx++) {
+	  const float* p = row + 3 * (x * box_width + dx);
+	  for(int c = 0; c < 3; c++) {
+	    sum[c] += std::isfinite(p[c]) ? p[c] : 0.0f;
+	  }
+	}
+      }
+      for(int c = 0; c < 3; c++) {
+	small[3 * (y * out_width + x) + c] = sum[c] * inv_area;
+      }
+    }
+  }
+
+  float offset[3] = {0.0f, 0.0f, 0.0f};
+  float scale[3] = {1.0f, 1.0f, 1.0f};
+  if(mode == "normalize") {
+    float smallest[3] = {1e30f, 1e30f, 1e30f};
+    float biggest[3] = {-1e30f, -1e30f, -1e30f};
+    for(size_t i = 0; i < small.size(); i += 3) {
+      for(int c = 0; c < 3; c++) {
+	smallest[c] = std::min(smallest[c], small[i + c]);
+	biggest[c] = std::max(biggest[c], small[i + c]);
+      }
+    }
+    for(int c = 0; c < 3; c++) {
+      offset[c] = smallest[c];
+      scale[c] = biggest[c] > smallest[c] ? 1.0f / (biggest[c] - smallest[c]) : 0.0f;
+    }
+  }
+
+  const float inv_gamma = 1.0f / 2.2f;
+  std::vector<uint8_t> out(small.size());
+  for(size_t i = 0; i < small.size(); i++) {
+    float v = small[i];
+    if(mode == "tonemap") {
+      v = std::max(v, 0.0f);
+      v = std::pow(v / (1.0f + v), inv_gamma);
+    } else if(mode == "normalize") {
+      v = (v - offset[i % 3]) * scale[i % 3];
+    } else if(mode == "signed") {
+      v = v * 0.5f + 0.5f;
+    } else {
+      v = std::pow(std::min(std::max(v, 0.0f), 1.0f), inv_gamma);
+    }
+    out[i] = (uint8_t)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+  }
+
+  int ok;
+  if(format == "jpg") {
+    ok = stbi_write_jpg(file_name.c_str(), out_width, out_height, 3, out.data(), quality);
+  } else {
+    ok = stbi_write_png(file_name.c_str(), out_width, out_height, 3, out.data(), out_width * 3);
+  }
+
+  // A failed preview is not worth aborting the float output for
+  if(!ok) {
+    std::cerr << "Could not write preview image " << file_name << std::endl;
+  }
+}
 
 /*
 	PBR example main class
@@ -181,10 +276,98 @@ public:
 
 	struct Pipelines {
 		VkPipeline skybox;
-		VkPipeline pbr;
-		VkPipeline pbrAlphaBlend;
+		VkPipeline pbr = VK_NULL_HANDLE;
+		VkPipeline pbrAlphaBlend = VK_NULL_HANDLE;
+		// Variants reading node blocks and materials through the draw's firstInstance, see recordIndirectDraws
+		VkPipeline pbrIndirect = VK_NULL_HANDLE;
+		VkPipeline pbrAlphaBlendIndirect = VK_NULL_HANDLE;
+		// Depth pre-pass of opaque and (alpha tested) masked draws, see settings.depth_prepass
+		VkPipeline pbrDepth = VK_NULL_HANDLE;
+		VkPipeline pbrDepthMask = VK_NULL_HANDLE;
+		VkPipeline pbrDepthIndirect = VK_NULL_HANDLE;
+		VkPipeline pbrDepthMaskIndirect = VK_NULL_HANDLE;
 	} pipelines;
 
+	// Lean PBR pipelines of each requested feature buffer, indexed like available_features (0 is unused)
+	struct FeaturePipelines {
+		VkPipeline pbr = VK_NULL_HANDLE;
+		VkPipeline pbrAlphaBlend = VK_NULL_HANDLE;
+		VkPipeline pbrIndirect = VK_NULL_HANDLE;
+		VkPipeline pbrAlphaBlendIndirect = VK_NULL_HANDLE;
+	};
+	std::vector<FeaturePipelines> featurePipelines;
+	// Feature whose pipelines the scene is recorded with, 0 for the general pipelines
+	uint32_t pipelineFeature = 0;
+
+	// Fragment specialization: size of the bindless texture array (constant 0), feature output (constant 1) and material permutation (constant 2)
+	struct FragmentSpecialization {
+		uint32_t textureCount;
+		int32_t feature;
+		uint32_t permutation;
+	};
+	// Permutation of the general pipelines, which read the material's texture sets, workflow and alpha mode at runtime
+	static const uint32_t PERMUTATION_DYNAMIC = 0xFFFFFFFF;
+
+	/*
+		Fixed function state and shaders of a general PBR pipeline, kept to create its material permutations on first use
+		Shaders are loaded again by name when a permutation is created, see permutationPipeline
+	*/
+	struct PbrPipelineState {
+		std::string vertexShader;
+		std::string fragmentShader;
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+		VkVertexInputBindingDescription vertexBinding;
+		std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+		VkPipelineVertexInputStateCreateInfo vertexInput;
+		VkPipelineRasterizationStateCreateInfo rasterization;
+		VkPipelineColorBlendAttachmentState blendAttachment;
+		VkPipelineColorBlendStateCreateInfo colorBlend;
+		VkPipelineMultisampleStateCreateInfo multisample;
+		VkPipelineViewportStateCreateInfo viewport;
+		VkPipelineDepthStencilStateCreateInfo depthStencil;
+		std::vector<VkDynamicState> dynamicStates;
+		VkPipelineDynamicStateCreateInfo dynamic;
+		VkGraphicsPipelineCreateInfo pipelineCI;
+
+		// Copy the state a pipeline create info points to, which has a single vertex binding and blend attachment
+		void capture(const VkGraphicsPipelineCreateInfo &ci, const std::string &vertex, const std::string &fragment)
+		{
+			vertexShader = vertex;
+			fragmentShader = fragment;
+			inputAssembly = *ci.pInputAssemblyState;
+			vertexInput = *ci.pVertexInputState;
+			vertexBinding = *vertexInput.pVertexBindingDescriptions;
+			vertexAttributes.assign(vertexInput.pVertexAttributeDescriptions, vertexInput.pVertexAttributeDescriptions + vertexInput.vertexAttributeDescriptionCount);
+			vertexInput.pVertexBindingDescriptions = &vertexBinding;
+			vertexInput.pVertexAttributeDescriptions = vertexAttributes.data();
+			rasterization = *ci.pRasterizationState;
+			colorBlend = *ci.pColorBlendState;
+			blendAttachment = *colorBlend.pAttachments;
+			colorBlend.pAttachments = &blendAttachment;
+			multisample = *ci.pMultisampleState;
+			viewport = *ci.pViewportState;
+			depthStencil = *ci.pDepthStencilState;
+			dynamic = *ci.pDynamicState;
+			dynamicStates.assign(dynamic.pDynamicStates, dynamic.pDynamicStates + dynamic.dynamicStateCount);
+			dynamic.pDynamicStates = dynamicStates.data();
+			pipelineCI = ci;
+			pipelineCI.pInputAssemblyState = &inputAssembly;
+			pipelineCI.pVertexInputState = &vertexInput;
+			pipelineCI.pRasterizationState = &rasterization;
+			pipelineCI.pColorBlendState = &colorBlend;
+			pipelineCI.pMultisampleState = &multisample;
+			pipelineCI.pViewportState = &viewport;
+			pipelineCI.pDepthStencilState = &depthStencil;
+			pipelineCI.pDynamicState = &dynamic;
+			pipelineCI.stageCount = 0;
+			pipelineCI.pStages = nullptr;
+		}
+	};
+	// General PBR pipeline states by pbrPipelineKind, without shaders for kinds that were not created
+	std::array<PbrPipelineState, 4> pbrPipelineStates;
+	// Material permutation pipelines created so far, by kind, feature and permutation
+	std::map<uint64_t, VkPipeline> permutationPipelines;
+
 	struct DescriptorSetLayouts {
 		VkDescriptorSetLayout scene;
 		VkDescriptorSetLayout material;
@@ -224,6 +407,8 @@ public:
 	VkCommandBuffer commandBuffers[4]; // Assume we don't have more than 4 swapchain buffers
 	VkCommandBuffer secondCommandBuffer;
 	VkRenderPass renderPass;
+	// Same attachments as renderPass, but keeping their contents for the draws after occlusion culling
+	VkRenderPass renderPassLoad = VK_NULL_HANDLE;
     } customStuff;
     
 	std::vector<DescriptorSets> descriptorSets;
@@ -281,6 +466,21 @@ public:
 		float alphaMask;
 		float alphaMaskCutoff;
 	} pushConstBlockMaterial;
+	// Push constants of each scene model material, built once after loading
+	std::vector<PushConstBlockMaterial> materialPushConstants;
+	// The same material parameters in a storage buffer for indirect draws, padded to the std430 array stride
+	struct ShaderMaterial {
+		PushConstBlockMaterial params;
+		// Slots of the material's textures in the bindless texture array, see materialTextures
+		int32_t textureIndices[5];
+		float padding;
+	};
+	Buffer materialBuffer;
+
+	// Bindless materials: one set holding all scene model textures, element 0 is the empty texture
+	bool bindless = false;
+	uint32_t bindlessTextureCount = 0;
+	VkDescriptorSet bindlessDescriptorSet = VK_NULL_HANDLE;
 
 	std::map<std::string, std::string> environments;
 	std::string selectedEnvironment = "papermill";
@@ -293,6 +493,89 @@ public:
 	int32_t debugViewInputs = 0;
 	int32_t debugViewEquation = 0;
 
+	// Encodes output images off the render loop
+	vks::ThreadPool writerPool;
+	// Helps the render thread with scene updates, empty for single threaded updates
+	vks::ThreadPool updatePool;
+
+	// Compute pass deforming morphed and (optionally) skinned vertices once per pose
+	struct ComputeDeform {
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkDescriptorSetLayout descriptorSetLayout;
+		VkDescriptorSet descriptorSet;
+		VkPipelineLayout pipelineLayout;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+		// Pose of the scene model the deformed vertex buffer currently holds
+		uint32_t poseVersion = UINT32_MAX;
+	} computeDeform;
+
+	// Compute pass frustum culling the indirect draws of the scene model before each frame's draws
+	struct GpuCulling {
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkDescriptorSetLayout descriptorSetLayout;
+		VkDescriptorSet descriptorSet;
+		VkPipelineLayout pipelineLayout;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		// Compacted draw commands, read by recordIndirectDraws instead of the model's draw command buffer
+		Buffer commands;
+		// Visible and total draw count followed by one compaction counter per draw batch
+		Buffer counters;
+		Buffer params;
+		/*
+			Two-phase occlusion culling: the early phase draws what was visible last frame, the late phase tests all
+			draws against the depth pyramid built from that and draws the newly visible ones into the same attachments
+			The late phase has its own descriptor set, commands and counters
+		*/
+		bool occlusion = false;
+		VkDescriptorSet lateDescriptorSet;
+		Buffer lateCommands;
+		Buffer lateCounters;
+		// Visibility of each draw in the previous frame's late phase
+		Buffer visibility;
+	} gpuCulling;
+
+	enum CullPhase : uint32_t { CULL_PHASE_ALL = 0, CULL_PHASE_EARLY = 1, CULL_PHASE_LATE = 2 };
+
+	struct CullParams {
+		glm::vec4 planes[6];
+		glm::mat4 viewProjection;
+		uint32_t drawCount;
+		uint32_t padding;
+		glm::vec2 pyramidSize;
+	};
+
+	// Mip chain of the farthest depth of the early phase's depth buffer, level 0 is a power of two below the frame size
+	struct DepthPyramid {
+		VkImage image = VK_NULL_HANDLE;
+		VkDeviceMemory memory;
+		VkImageView view;
+		std::vector<VkImageView> levelViews;
+		uint32_t width, height, levels;
+		VkSampler sampler = VK_NULL_HANDLE;
+		// Depth aspect of the scene's depth attachment, read by the first level
+		VkImageView depthView;
+		VkDescriptorPool descriptorPool;
+		VkDescriptorSetLayout descriptorSetLayout;
+		std::vector<VkDescriptorSet> descriptorSets;
+		VkPipelineLayout pipelineLayout;
+		VkPipeline pipeline;
+	} depthPyramid;
+
+	// Visible draws of every rendered path frame, and the decoded set of the current frame
+	vkglTF::PathVisibility pathVisibility;
+	std::vector<uint64_t> pathVisible;
+
+	// Culling results summed over all rendered frames
+	struct CullStats {
+		uint64_t visible = 0;
+		uint64_t total = 0;
+		// Draws only found visible by the late occlusion culling phase
+		uint64_t late = 0;
+		uint32_t frames = 0;
+	} cullStats;
+
 	VulkanExample() : VulkanExampleBase()
 	{
 		title = "Vulkan glTF 2.0 PBR - � Sascha Willems (www.saschawillems.de)";
@@ -303,11 +586,67 @@ public:
 
 	~VulkanExample()
 	{
-	    
+	    // Finish writing all images before tearing down
+	    writerPool.stop();
+	    updatePool.stop();
+
 	    destroyCustomStuff();
+		if (computeDeform.pipeline != VK_NULL_HANDLE) {
+			vkWaitForFences(device, 1, &computeDeform.fence, VK_TRUE, UINT64_MAX);
+			vkDestroyFence(device, computeDeform.fence, nullptr);
+			vkDestroyPipeline(device, computeDeform.pipeline, nullptr);
+			vkDestroyPipelineLayout(device, computeDeform.pipelineLayout, nullptr);
+			vkDestroyDescriptorSetLayout(device, computeDeform.descriptorSetLayout, nullptr);
+			vkDestroyDescriptorPool(device, computeDeform.descriptorPool, nullptr);
+		}
+		if (gpuCulling.pipeline != VK_NULL_HANDLE) {
+			vkDestroyPipeline(device, gpuCulling.pipeline, nullptr);
+			vkDestroyPipelineLayout(device, gpuCulling.pipelineLayout, nullptr);
+			vkDestroyDescriptorSetLayout(device, gpuCulling.descriptorSetLayout, nullptr);
+			vkDestroyDescriptorPool(device, gpuCulling.descriptorPool, nullptr);
+			gpuCulling.commands.destroy();
+			gpuCulling.counters.destroy();
+			gpuCulling.params.destroy();
+		}
+		if (gpuCulling.occlusion) {
+			gpuCulling.lateCommands.destroy();
+			gpuCulling.lateCounters.destroy();
+			gpuCulling.visibility.destroy();
+			vkDestroyPipeline(device, depthPyramid.pipeline, nullptr);
+			vkDestroyPipelineLayout(device, depthPyramid.pipelineLayout, nullptr);
+			vkDestroyDescriptorSetLayout(device, depthPyramid.descriptorSetLayout, nullptr);
+			vkDestroyDescriptorPool(device, depthPyramid.descriptorPool, nullptr);
+			vkDestroySampler(device, depthPyramid.sampler, nullptr);
+			vkDestroyImageView(device, depthPyramid.depthView, nullptr);
+			for (VkImageView levelView : depthPyramid.levelViews) {
+				vkDestroyImageView(device, levelView, nullptr);
+			}
+			vkDestroyImageView(device, depthPyramid.view, nullptr);
+			vkDestroyImage(device, depthPyramid.image, nullptr);
+			vkFreeMemory(device, depthPyramid.memory, nullptr);
+		}
 		vkDestroyPipeline(device, pipelines.skybox, nullptr);
 		vkDestroyPipeline(device, pipelines.pbr, nullptr);
 		vkDestroyPipeline(device, pipelines.pbrAlphaBlend, nullptr);
+		if (pipelines.pbrIndirect != VK_NULL_HANDLE) {
+			vkDestroyPipeline(device, pipelines.pbrIndirect, nullptr);
+			vkDestroyPipeline(device, pipelines.pbrAlphaBlendIndirect, nullptr);
+		}
+		for (VkPipeline pipeline : { pipelines.pbrDepth, pipelines.pbrDepthMask, pipelines.pbrDepthIndirect, pipelines.pbrDepthMaskIndirect }) {
+			if (pipeline != VK_NULL_HANDLE) {
+				vkDestroyPipeline(device, pipeline, nullptr);
+			}
+		}
+		for (const FeaturePipelines &feature : featurePipelines) {
+			for (VkPipeline pipeline : { feature.pbr, feature.pbrAlphaBlend, feature.pbrIndirect, feature.pbrAlphaBlendIndirect }) {
+				if (pipeline != VK_NULL_HANDLE) {
+					vkDestroyPipeline(device, pipeline, nullptr);
+				}
+			}
+		}
+		for (auto &permutation : permutationPipelines) {
+			vkDestroyPipeline(device, permutation.second, nullptr);
+		}
 
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.scene, nullptr);
@@ -316,6 +655,7 @@ public:
 
 		models.scene.destroy(device);
 		models.skybox.destroy(device);
+		materialBuffer.destroy();
 
 		for (auto buffer : uniformBuffers) {
 			buffer.params.destroy();
@@ -344,66 +684,340 @@ public:
 #endif // WITH_DISPLAY
 	}
 
-	void renderNode(vkglTF::Node *node, int32_t cbIndex, vkglTF::Material::AlphaMode alphaMode) {
-	    
-		if (node->mesh) {
-			// Render mesh primitives
-			for (vkglTF::Primitive * primitive : node->mesh->primitives) {
-				if (primitive->material.alphaMode == alphaMode) {
-
-					const std::vector<VkDescriptorSet> descriptorsets = {
-											     descriptorSets[cbIndex <= -1 ? - cbIndex - 1 : cbIndex].scene,
-						primitive->material.descriptorSet,
-						node->mesh->uniformBuffer.descriptorSet,
-					};
-					vkCmdBindDescriptorSets(cbIndex <= -1 ? customStuff.commandBuffers[- cbIndex - 1]: commandBuffers[cbIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorsets.size()), descriptorsets.data(), 0, NULL);
-
-					// Pass material parameters as push constants
-					PushConstBlockMaterial pushConstBlockMaterial{};					
-					pushConstBlockMaterial.emissiveFactor = primitive->material.emissiveFactor;
-					// To save push constant space, availabilty and texture coordiante set are combined
-					// -1 = texture not used for this material, >= 0 texture used and index of texture coordinate set
-					pushConstBlockMaterial.colorTextureSet = primitive->material.baseColorTexture != nullptr ? primitive->material.texCoordSets.baseColor : -1;
-					pushConstBlockMaterial.normalTextureSet = primitive->material.normalTexture != nullptr ? primitive->material.texCoordSets.normal : -1;
-					pushConstBlockMaterial.occlusionTextureSet = primitive->material.occlusionTexture != nullptr ? primitive->material.texCoordSets.occlusion : -1;
-					pushConstBlockMaterial.emissiveTextureSet = primitive->material.emissiveTexture != nullptr ? primitive->material.texCoordSets.emissive : -1;
-					pushConstBlockMaterial.alphaMask = static_cast<float>(primitive->material.alphaMode == vkglTF::Material::ALPHAMODE_MASK);
-					pushConstBlockMaterial.alphaMaskCutoff = primitive->material.alphaCutoff;
-
-					// TODO: glTF specs states that metallic roughness should be preferred, even if specular glosiness is present
-
-					if (primitive->material.pbrWorkflows.metallicRoughness) {
-						// Metallic roughness workflow
-						pushConstBlockMaterial.workflow = static_cast<float>(PBR_WORKFLOW_METALLIC_ROUGHNESS);
-						pushConstBlockMaterial.baseColorFactor = primitive->material.baseColorFactor;
-						pushConstBlockMaterial.metallicFactor = primitive->material.metallicFactor;
-						pushConstBlockMaterial.roughnessFactor = primitive->material.roughnessFactor;
-						pushConstBlockMaterial.PhysicalDescriptorTextureSet = primitive->material.metallicRoughnessTexture != nullptr ? primitive->material.texCoordSets.metallicRoughness : -1;
-						pushConstBlockMaterial.colorTextureSet = primitive->material.baseColorTexture != nullptr ? primitive->material.texCoordSets.baseColor : -1;
-					}
+	// Material parameters as passed to the fragment shader, one block per model material
+	PushConstBlockMaterial pushConstantsForMaterial(const vkglTF::Material &material) const
+	{
+		PushConstBlockMaterial pushConstBlockMaterial{};
+		pushConstBlockMaterial.emissiveFactor = material.emissiveFactor;
+		// To save push constant space, availabilty and texture coordiante set are combined
+		// -1 = texture not used for this material, >= 0 texture used and index of texture coordinate set
+		pushConstBlockMaterial.colorTextureSet = material.baseColorTexture != nullptr ? material.texCoordSets.baseColor : -1;
+		pushConstBlockMaterial.normalTextureSet = material.normalTexture != nullptr ? material.texCoordSets.normal : -1;
+		pushConstBlockMaterial.occlusionTextureSet = material.occlusionTexture != nullptr ? material.texCoordSets.occlusion : -1;
+		pushConstBlockMaterial.emissiveTextureSet = material.emissiveTexture != nullptr ? material.texCoordSets.emissive : -1;
+		pushConstBlockMaterial.alphaMask = static_cast<float>(material.alphaMode == vkglTF::Material::ALPHAMODE_MASK);
+		pushConstBlockMaterial.alphaMaskCutoff = material.alphaCutoff;
+
+		// TODO: glTF specs states that metallic roughness should be preferred, even if specular glosiness is present
+
+		if (material.pbrWorkflows.metallicRoughness) {
+			// Metallic roughness workflow
+			pushConstBlockMaterial.workflow = static_cast<float>(PBR_WORKFLOW_METALLIC_ROUGHNESS);
+			pushConstBlockMaterial.baseColorFactor = material.baseColorFactor;
+			pushConstBlockMaterial.metallicFactor = material.metallicFactor;
+			pushConstBlockMaterial.roughnessFactor = material.roughnessFactor;
+			pushConstBlockMaterial.PhysicalDescriptorTextureSet = material.metallicRoughnessTexture != nullptr ? material.texCoordSets.metallicRoughness : -1;
+			pushConstBlockMaterial.colorTextureSet = material.baseColorTexture != nullptr ? material.texCoordSets.baseColor : -1;
+		}
 
-					if (primitive->material.pbrWorkflows.specularGlossiness) {
-						// Specular glossiness workflow
-						pushConstBlockMaterial.workflow = static_cast<float>(PBR_WORKFLOW_SPECULAR_GLOSINESS);
-						pushConstBlockMaterial.PhysicalDescriptorTextureSet = primitive->material.extension.specularGlossinessTexture != nullptr ? primitive->material.texCoordSets.specularGlossiness : -1;
-						pushConstBlockMaterial.colorTextureSet = primitive->material.extension.diffuseTexture != nullptr ? primitive->material.texCoordSets.baseColor : -1;
-						pushConstBlockMaterial.diffuseFactor = primitive->material.extension.diffuseFactor;
-						pushConstBlockMaterial.specularFactor = glm::vec4(primitive->material.extension.specularFactor, 1.0f);
-					}
+		if (material.pbrWorkflows.specularGlossiness) {
+			// Specular glossiness workflow
+			pushConstBlockMaterial.workflow = static_cast<float>(PBR_WORKFLOW_SPECULAR_GLOSINESS);
+			pushConstBlockMaterial.PhysicalDescriptorTextureSet = material.extension.specularGlossinessTexture != nullptr ? material.texCoordSets.specularGlossiness : -1;
+			pushConstBlockMaterial.colorTextureSet = material.extension.diffuseTexture != nullptr ? material.texCoordSets.baseColor : -1;
+			pushConstBlockMaterial.diffuseFactor = material.extension.diffuseFactor;
+			pushConstBlockMaterial.specularFactor = glm::vec4(material.extension.specularFactor, 1.0f);
+		}
+		return pushConstBlockMaterial;
+	}
 
-					vkCmdPushConstants(cbIndex <= -1 ? customStuff.commandBuffers[- cbIndex - 1]: commandBuffers[cbIndex], pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstBlockMaterial), &pushConstBlockMaterial);
+	/*
+		Textures bound to the five material slots (color, physical descriptor, normal, occlusion, emissive)
+		nullptr for slots the material leaves empty
+	*/
+	std::array<const vkglTF::Texture*, 5> materialTextures(const vkglTF::Material &material) const
+	{
+		std::array<const vkglTF::Texture*, 5> slots = {
+			nullptr, nullptr, material.normalTexture, material.occlusionTexture, material.emissiveTexture
+		};
 
-					if (primitive->hasIndices) {
-						vkCmdDrawIndexed(cbIndex <= -1 ? customStuff.commandBuffers[- cbIndex - 1]: commandBuffers[cbIndex], primitive->indexCount, 1, primitive->firstIndex, 0, 0);
-					} else {
-						vkCmdDraw(cbIndex <= -1 ? customStuff.commandBuffers[- cbIndex - 1]: commandBuffers[cbIndex], primitive->vertexCount, 1, 0, 0);
-					}
-				}
+		// TODO: glTF specs states that metallic roughness should be preferred, even if specular glosiness is present
+
+		if (material.pbrWorkflows.metallicRoughness) {
+			if (material.baseColorTexture) {
+				slots[0] = material.baseColorTexture;
+			}
+			if (material.metallicRoughnessTexture) {
+				slots[1] = material.metallicRoughnessTexture;
+			}
+		}
+
+		if (material.pbrWorkflows.specularGlossiness) {
+			if (material.extension.diffuseTexture) {
+				slots[0] = material.extension.diffuseTexture;
 			}
+			if (material.extension.specularGlossinessTexture) {
+				slots[1] = material.extension.specularGlossinessTexture;
+			}
+		}
+		return slots;
+	}
+
+	// Element of a scene model texture in the bindless texture array
+	int32_t bindlessTextureIndex(const vkglTF::Texture *texture) const
+	{
+		return texture ? 1 + static_cast<int32_t>(texture - models.scene.textures.data()) : 0;
+	}
 
+	/*
+		Bindless materials need indirect draws, dynamic indexing of sampler arrays and room for all model
+		textures next to the environment samplers in the fragment stage
+	*/
+	bool supportsBindless() const
+	{
+		const VkPhysicalDeviceLimits &limits = vulkanDevice->properties.limits;
+		const uint32_t samplerCount = static_cast<uint32_t>(models.scene.textures.size()) + 1 + 3;
+		return settings.bindless
+			&& vulkanDevice->enabledFeatures.drawIndirectFirstInstance
+			&& vulkanDevice->enabledFeatures.shaderSampledImageArrayDynamicIndexing
+			&& samplerCount <= limits.maxPerStageDescriptorSamplers
+			&& samplerCount <= limits.maxPerStageDescriptorSampledImages;
+	}
+
+	/*
+		Record the scene model's draw list
+		The list is sorted by state, so pipelines, material descriptor sets with their push constants and node blocks
+		are only bound when they differ from the previous draw's
+		With CPU culling, draws outside the frustum of the last cullDraws call are skipped, with path visibility the
+		draws not visible in the current path frame
+		depthOnly records the depth pre-pass of the opaque and masked draws instead
+	*/
+	void recordDrawList(VkCommandBuffer cb, VkDescriptorSet sceneDescriptorSet, bool depthOnly = false)
+	{
+		vkglTF::Model &model = models.scene;
+		if (model.drawList.empty()) {
+			return;
+		}
+		vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &sceneDescriptorSet, 0, nullptr);
+
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+		uint32_t boundMaterial = UINT32_MAX;
+		uint32_t boundMesh = UINT32_MAX;
+		for (uint32_t i = 0; i < model.drawList.size(); i++) {
+			const vkglTF::DrawCommand &draw = model.drawList[i];
+			if (settings.cpu_culling && !model.cullingBounds.isVisible(i)) {
+				continue;
+			}
+			if (!pathVisible.empty() && !vkglTF::PathVisibility::bit(pathVisible, i)) {
+				continue;
+			}
+			if (depthOnly && draw.alphaMode == vkglTF::Material::ALPHAMODE_BLEND) {
+				continue;
+			}
+			const VkPipeline pipeline = drawPipeline(draw.alphaMode, draw.material, depthOnly, false);
+			if (pipeline != boundPipeline) {
+				vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				boundPipeline = pipeline;
+			}
+			// The opaque depth pipeline has no fragment shader, so it reads no material
+			if (draw.material != boundMaterial && pipeline != pipelines.pbrDepth) {
+				const vkglTF::Material &material = model.materials[draw.material];
+				vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &material.descriptorSet, 0, nullptr);
+				vkCmdPushConstants(cb, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstBlockMaterial), &materialPushConstants[draw.material]);
+				boundMaterial = draw.material;
+			}
+			if (draw.mesh != boundMesh) {
+				const uint32_t nodeOffset = model.nodeBlockOffset(draw.mesh);
+				vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &model.nodeDescriptorSet, 1, &nodeOffset);
+				boundMesh = draw.mesh;
+			}
+
+			const vkglTF::Primitive &primitive = model.primitives[draw.primitive];
+			if (primitive.hasIndices) {
+				vkCmdDrawIndexed(cb, primitive.indexCount, 1, primitive.firstIndex, 0, 0);
+			} else {
+				vkCmdDraw(cb, primitive.vertexCount, 1, primitive.firstVertex, 0);
+			}
+		}
+	}
+
+	bool useIndirectDraws() const
+	{
+		return pipelines.pbrIndirect != VK_NULL_HANDLE;
+	}
+
+	// Pipeline drawing a scene material of the given alpha mode, in the depth pre-pass if depthOnly
+	VkPipeline drawPipeline(vkglTF::Material::AlphaMode alphaMode, uint32_t material, bool depthOnly, bool indirect)
+	{
+		if (depthOnly) {
+			if (alphaMode == vkglTF::Material::ALPHAMODE_MASK) {
+				return indirect ? pipelines.pbrDepthMaskIndirect : pipelines.pbrDepthMask;
+			}
+			return indirect ? pipelines.pbrDepthIndirect : pipelines.pbrDepth;
+		}
+		const uint32_t kind = pbrPipelineKind(alphaMode == vkglTF::Material::ALPHAMODE_BLEND, indirect);
+		if (settings.material_permutations && !pbrPipelineStates[kind].vertexShader.empty()) {
+			return permutationPipeline(kind, models.scene.materials[material].permutation);
+		}
+		if (pipelineFeature > 0) {
+			const FeaturePipelines &feature = featurePipelines[pipelineFeature];
+			if (alphaMode == vkglTF::Material::ALPHAMODE_BLEND) {
+				return indirect ? feature.pbrAlphaBlendIndirect : feature.pbrAlphaBlend;
+			}
+			return indirect ? feature.pbrIndirect : feature.pbr;
+		}
+		if (alphaMode == vkglTF::Material::ALPHAMODE_BLEND) {
+			return indirect ? pipelines.pbrAlphaBlendIndirect : pipelines.pbrAlphaBlend;
+		}
+		return indirect ? pipelines.pbrIndirect : pipelines.pbr;
+	}
+
+	static uint32_t pbrPipelineKind(bool blend, bool indirect)
+	{
+		return (indirect ? 2 : 0) + (blend ? 1 : 0);
+	}
+
+	static VkSpecializationInfo fragmentSpecializationInfo(const FragmentSpecialization &specialization)
+	{
+		static const VkSpecializationMapEntry entries[] = {
+			{ 0, offsetof(FragmentSpecialization, textureCount), sizeof(uint32_t) },
+			{ 1, offsetof(FragmentSpecialization, feature), sizeof(int32_t) },
+			{ 2, offsetof(FragmentSpecialization, permutation), sizeof(uint32_t) }
 		};
-		for (auto child : node->children) {
-			renderNode(child, cbIndex, alphaMode);
+		return { 3, entries, sizeof(FragmentSpecialization), &specialization };
+	}
+
+	/*
+		General PBR pipeline of a kind specialized for a material permutation and the selected feature
+		Permutations are created the first time one of their draws is recorded and kept for all later recordings,
+		they share their fixed function state so the pipeline cache serves most of their creation
+	*/
+	VkPipeline permutationPipeline(uint32_t kind, uint32_t permutation)
+	{
+		const uint64_t key = static_cast<uint64_t>(permutation) << 32 | (pipelineFeature << 2) | kind;
+		auto cached = permutationPipelines.find(key);
+		if (cached != permutationPipelines.end()) {
+			return cached->second;
+		}
+		const PbrPipelineState &state = pbrPipelineStates[kind];
+		const FragmentSpecialization specialization = { bindlessTextureCount, static_cast<int32_t>(pipelineFeature), permutation };
+		const VkSpecializationInfo specializationInfo = fragmentSpecializationInfo(specialization);
+		std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {
+			loadShader(device, state.vertexShader, VK_SHADER_STAGE_VERTEX_BIT),
+			loadShader(device, state.fragmentShader, VK_SHADER_STAGE_FRAGMENT_BIT)
+		};
+		shaderStages[1].pSpecializationInfo = &specializationInfo;
+		VkGraphicsPipelineCreateInfo pipelineCI = state.pipelineCI;
+		pipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
+		pipelineCI.pStages = shaderStages.data();
+		VkPipeline pipeline;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipeline));
+		for (auto shaderStage : shaderStages) {
+			vkDestroyShaderModule(device, shaderStage.module, nullptr);
+		}
+		permutationPipelines[key] = pipeline;
+		return pipeline;
+	}
+
+	// Index of a feature buffer name in available_features, which is also its debugViewEquation, -1 if unknown
+	int featureIndex(const std::string &name) const
+	{
+		for (int i = 0; i < num_available_features; i++) {
+			if (name == available_features[i]) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	// Record the scene with the lean pipelines of a feature buffer, or the general ones for 0 or features without them
+	void selectFeaturePipelines(uint32_t feature)
+	{
+		if (feature >= featurePipelines.size() || (featurePipelines[feature].pbr == VK_NULL_HANDLE && featurePipelines[feature].pbrIndirect == VK_NULL_HANDLE)) {
+			feature = 0;
+		}
+		if (feature == pipelineFeature) {
+			return;
+		}
+		pipelineFeature = feature;
+		VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+		for (size_t i = 0; i < commandBuffers.size(); i++) {
+			recordCustomCommandBuffer(i);
+		}
+	}
+
+	// Record the scene's draws of a culling phase, preceded by their depth pre-pass if enabled
+	void recordScene(VkCommandBuffer cb, VkDescriptorSet sceneDescriptorSet, CullPhase phase = CULL_PHASE_ALL)
+	{
+		if (useIndirectDraws()) {
+			if (settings.depth_prepass) {
+				recordIndirectDraws(cb, sceneDescriptorSet, phase, true);
+			}
+			recordIndirectDraws(cb, sceneDescriptorSet, phase);
+		} else {
+			if (settings.depth_prepass) {
+				recordDrawList(cb, sceneDescriptorSet, true);
+			}
+			recordDrawList(cb, sceneDescriptorSet);
+		}
+	}
+
+	/*
+		Record the scene model's draw list with indirect draws
+		Node blocks and material parameters are read from storage buffers indexed by the draw's firstInstance, so only
+		the pipeline and the material textures change between batches and each batch is a single multi-draw
+		With occlusion culling, the early and late phases each draw from their own compacted commands
+		depthOnly records the depth pre-pass of the opaque and masked draws instead
+	*/
+	void recordIndirectDraws(VkCommandBuffer cb, VkDescriptorSet sceneDescriptorSet, CullPhase phase = CULL_PHASE_ALL, bool depthOnly = false)
+	{
+		vkglTF::Model &model = models.scene;
+		if (model.drawBatches.empty()) {
+			return;
+		}
+		const uint32_t nodeOffset = 0;
+		vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &sceneDescriptorSet, 0, nullptr);
+		vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &model.nodeDescriptorSet, 1, &nodeOffset);
+		if (bindless) {
+			vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &bindlessDescriptorSet, 0, nullptr);
+		}
+
+		// Culled draws are empty commands in the compacted buffer, so batch ranges stay the same
+		VkBuffer commandBuffer = gpuCulling.pipeline != VK_NULL_HANDLE ? gpuCulling.commands.buffer : model.drawCommandBuffer.buffer;
+		if (phase == CULL_PHASE_LATE) {
+			commandBuffer = gpuCulling.lateCommands.buffer;
+		}
+		const bool multiDraw = vulkanDevice->enabledFeatures.multiDrawIndirect == VK_TRUE;
+		const VkDeviceSize commandStride = sizeof(VkDrawIndexedIndirectCommand);
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+		uint32_t boundMaterial = UINT32_MAX;
+		for (size_t b = 0; b < model.drawBatches.size();) {
+			vkglTF::DrawBatch batch = model.drawBatches[b++];
+			const bool blend = batch.alphaMode == vkglTF::Material::ALPHAMODE_BLEND;
+			const VkPipeline pipeline = drawPipeline(batch.alphaMode, batch.material, depthOnly, true);
+			// Without material descriptor sets, consecutive batches drawn with the same pipeline form a single run
+			while (bindless && b < model.drawBatches.size() && model.drawBatches[b].indexed == batch.indexed
+				&& drawPipeline(model.drawBatches[b].alphaMode, model.drawBatches[b].material, depthOnly, true) == pipeline) {
+				batch.drawCount += model.drawBatches[b++].drawCount;
+			}
+			// Blended draws are left to the late phase, so they are drawn over all opaque ones
+			if ((phase == CULL_PHASE_EARLY && blend) || (phase == CULL_PHASE_LATE && !blend && !batch.indexed)) {
+				continue;
+			}
+			if (depthOnly && blend) {
+				continue;
+			}
+			if (pipeline != boundPipeline) {
+				vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				boundPipeline = pipeline;
+			}
+			if (!bindless && batch.material != boundMaterial && pipeline != pipelines.pbrDepthIndirect) {
+				vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &model.materials[batch.material].descriptorSet, 0, nullptr);
+				boundMaterial = batch.material;
+			}
+
+			if (!batch.indexed) {
+				for (uint32_t i = batch.firstDraw; i < batch.firstDraw + batch.drawCount; i++) {
+					const vkglTF::Primitive &primitive = model.primitives[model.drawList[i].primitive];
+					vkCmdDraw(cb, primitive.vertexCount, 1, primitive.firstVertex, i);
+				}
+			} else if (multiDraw) {
+				vkCmdDrawIndexedIndirect(cb, commandBuffer, batch.firstDraw * commandStride, batch.drawCount, commandStride);
+			} else {
+				for (uint32_t i = batch.firstDraw; i < batch.firstDraw + batch.drawCount; i++) {
+					vkCmdDrawIndexedIndirect(cb, commandBuffer, i * commandStride, 1, commandStride);
+				}
+			}
 		}
 	}
 
@@ -428,6 +1042,8 @@ public:
 	VkCommandBuffer cb = customStuff.commandBuffers[ccb];
 
 	VK_CHECK_RESULT(vkBeginCommandBuffer(cb, &cmdBufferBeginInfo));
+	const CullPhase phase = gpuCulling.occlusion ? CULL_PHASE_EARLY : CULL_PHASE_ALL;
+	recordCulling(cb, phase);
 	vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
 
 	VkViewport viewport{};
@@ -449,28 +1065,33 @@ public:
 	    models.skybox.draw(cb);
 	}
 
-	vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.pbr);
-
 	vkglTF::Model &model = models.scene;
 
-	vkCmdBindVertexBuffers(cb, 0, 1, &model.vertices.buffer, offsets);
+	vkCmdBindVertexBuffers(cb, 0, 1, &model.drawVertexBuffer(), offsets);
 	if (model.indices.buffer != VK_NULL_HANDLE) {
 	    vkCmdBindIndexBuffer(cb, model.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 	}
 
-	for (auto node : model.nodes) {
-	    renderNode(node, - ccb - 1, vkglTF::Material::ALPHAMODE_OPAQUE);
-	}
-	for (auto node : model.nodes) {
-	    renderNode(node, - ccb - 1, vkglTF::Material::ALPHAMODE_MASK);
-	}
+	recordScene(cb, descriptorSets[ccb].scene, phase);
+
+	vkCmdEndRenderPass(cb);
 
-	vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.pbrAlphaBlend);
-	for (auto node : model.nodes) {
-	    renderNode(node, - ccb - 1, vkglTF::Material::ALPHAMODE_BLEND);
+	if (gpuCulling.occlusion) {
+	    // Cull everything against the depth of the early draws and add the newly visible draws
+	    recordDepthPyramid(cb);
+	    recordCulling(cb, CULL_PHASE_LATE);
+	    rpbi.renderPass = customStuff.renderPassLoad;
+	    vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+	    vkCmdSetViewport(cb, 0, 1, &viewport);
+	    vkCmdSetScissor(cb, 0, 1, &scissor);
+	    vkCmdBindVertexBuffers(cb, 0, 1, &model.drawVertexBuffer(), offsets);
+	    if (model.indices.buffer != VK_NULL_HANDLE) {
+		vkCmdBindIndexBuffer(cb, model.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+	    }
+	    recordScene(cb, descriptorSets[ccb].scene, CULL_PHASE_LATE);
+	    vkCmdEndRenderPass(cb);
 	}
 
-	vkCmdEndRenderPass(cb);
 	VK_CHECK_RESULT(vkEndCommandBuffer(cb));
     }
 
@@ -513,6 +1134,7 @@ public:
 			VkCommandBuffer currentCB = commandBuffers[i];
 
 			VK_CHECK_RESULT(vkBeginCommandBuffer(currentCB, &cmdBufferBeginInfo));
+			recordCulling(currentCB);
 			
 			vkCmdBeginRenderPass(currentCB, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 			
@@ -536,28 +1158,18 @@ public:
 				// models.skybox.draw(currentCB);
 			}
 
-			vkCmdBindPipeline(currentCB, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.pbr);
-
 			vkglTF::Model &model = models.scene;
 
-			vkCmdBindVertexBuffers(currentCB, 0, 1, &model.vertices.buffer, offsets);
+			vkCmdBindVertexBuffers(currentCB, 0, 1, &model.drawVertexBuffer(), offsets);
 			if (model.indices.buffer != VK_NULL_HANDLE) {
 				vkCmdBindIndexBuffer(currentCB, model.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 			}
-			// Opaque primitives first
-			for (auto node : model.nodes) {
-				renderNode(node, i, vkglTF::Material::ALPHAMODE_OPAQUE);
-			}
-
-			// Alpha masked primitives
-			for (auto node : model.nodes) {
-				renderNode(node, i, vkglTF::Material::ALPHAMODE_MASK);
-			}
-			// Transparent primitives
+			// Opaque, alpha masked, then transparent primitives
 			// TODO: Correct depth sorting
-			vkCmdBindPipeline(currentCB, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.pbrAlphaBlend);
-			for (auto node : model.nodes) {
-				renderNode(node, i, vkglTF::Material::ALPHAMODE_BLEND);
+			if (useIndirectDraws()) {
+				recordIndirectDraws(currentCB, descriptorSets[i].scene);
+			} else {
+				recordDrawList(currentCB, descriptorSets[i].scene);
 			}
 
 			// User interface
@@ -576,9 +1188,157 @@ public:
 		models.scene.destroy(device);
 		animationIndex = 0;
 		animationTimer = 0.0f;
+		models.scene.computeSkinning = settings.compute_skinning;
+		models.scene.updatePool = updatePool.size() > 0 ? &updatePool : nullptr;
+		models.scene.deferTextureUpload = settings.followPath && settings.texture_budget >= 0;
 		models.scene.loadFromFile(filename, vulkanDevice, queue);
+		materialPushConstants.clear();
+		for (const vkglTF::Material &material : models.scene.materials) {
+			materialPushConstants.push_back(pushConstantsForMaterial(material));
+		}
+		createMaterialBuffer();
 		camera.setPosition({ 0.0f, 0.0f, 1.0f });
 		camera.setRotation({ 0.0f, 0.0f, 0.0f });
+		bakePathPoses();
+		computePathVisibility();
+		uploadPathTextures();
+	}
+
+	void createMaterialBuffer()
+	{
+		if (materialBuffer.buffer != VK_NULL_HANDLE) {
+			materialBuffer.destroy();
+		}
+		std::vector<ShaderMaterial> shaderMaterials(std::max<size_t>(materialPushConstants.size(), 1));
+		for (size_t i = 0; i < materialPushConstants.size(); i++) {
+			shaderMaterials[i].params = materialPushConstants[i];
+			const std::array<const vkglTF::Texture*, 5> slots = materialTextures(models.scene.materials[i]);
+			for (size_t slot = 0; slot < slots.size(); slot++) {
+				shaderMaterials[i].textureIndices[slot] = bindlessTextureIndex(slots[slot]);
+			}
+		}
+		const VkDeviceSize size = shaderMaterials.size() * sizeof(ShaderMaterial);
+		materialBuffer.create(vulkanDevice, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, size);
+		memcpy(materialBuffer.mapped, shaderMaterials.data(), size);
+	}
+
+	// Range of path frames rendered in --path mode
+	size_t pathFrameBegin() const
+	{
+		return settings.interval_t0 == -1 ? 0 : settings.interval_t0;
+	}
+
+	size_t pathFrameEnd() const
+	{
+		return settings.interval_t1 == -1 ? settings.pathViews.size() : settings.interval_t1 + 1;
+	}
+
+	/*
+		Sample the animation at the scene time of every path frame before rendering starts
+		Rendering a frame then only copies its pose into the node and joint buffers (see render)
+	*/
+	void bakePathPoses()
+	{
+		models.scene.poseCache.clear();
+		const size_t begin = std::min(pathFrameBegin(), settings.pathTimes.size());
+		const size_t end = std::min(pathFrameEnd(), settings.pathTimes.size());
+		if (!settings.followPath || !animate || models.scene.animations.empty() || begin >= end) {
+			return;
+		}
+		auto tStart = std::chrono::high_resolution_clock::now();
+		const std::vector<float> times(settings.pathTimes.begin() + begin, settings.pathTimes.begin() + end);
+		models.scene.bakePoses(animationIndex, times);
+		auto tEnd = std::chrono::high_resolution_clock::now();
+		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		const vkglTF::Model::PoseCache &cache = models.scene.poseCache;
+		std::cout << "Baking " << times.size() << " animation poses took " << tDiff << " ms (" << cache.meshes.size() << " of " << models.scene.meshes.size()
+			<< " meshes, " << cache.jointCount << " of " << models.scene.joints.size() << " joints animated)" << std::endl;
+	}
+
+	/*
+		Find the visible draws of every path frame ahead of rendering, from the camera poses and baked animation poses
+		Draws never visible on the path are removed from the scene's draw list before any draws are recorded
+	*/
+	void computePathVisibility()
+	{
+		pathVisibility.clear();
+		pathVisible.clear();
+		const size_t begin = std::min(pathFrameBegin(), settings.pathViews.size());
+		const size_t end = std::min(pathFrameEnd(), settings.pathViews.size());
+		if (!settings.followPath || !settings.path_visibility || begin >= end) {
+			return;
+		}
+		auto tStart = std::chrono::high_resolution_clock::now();
+		const std::vector<glm::mat4> viewProjections = pathViewProjections();
+		vkglTF::Model &model = models.scene;
+		const uint32_t drawCount = static_cast<uint32_t>(model.drawList.size());
+		model.computeVisibility(viewProjections, pathVisibility);
+		const uint32_t seenCount = pathVisibility.everVisibleCount();
+		if (seenCount < drawCount) {
+			model.filterDrawList(pathVisibility.everVisible);
+			pathVisibility.compact();
+		}
+		auto tEnd = std::chrono::high_resolution_clock::now();
+		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		std::cout << "Path visibility of " << viewProjections.size() << " frames took " << tDiff << " ms, " << seenCount << " of " << drawCount
+			<< " draws are seen on the path (" << pathVisibility.sizeInBytes() / 1024 << " KB)" << std::endl;
+	}
+
+	// Model space view projection matrices of the path frames
+	std::vector<glm::mat4> pathViewProjections() const
+	{
+		std::vector<glm::mat4> viewProjections;
+		const size_t begin = std::min(pathFrameBegin(), settings.pathViews.size());
+		const size_t end = std::min(pathFrameEnd(), settings.pathViews.size());
+		Camera pathCamera = camera;
+		for (size_t frame = begin; frame < end; frame++) {
+			pathCamera.setRotation(settings.pathViews[frame].first);
+			pathCamera.setPosition(settings.pathViews[frame].second);
+			viewProjections.push_back(pathCamera.matrices.perspective * pathCamera.matrices.view * sceneModelMatrix());
+		}
+		return viewProjections;
+	}
+
+	/*
+		Upload the scene textures deferred by loadScene with only the mip levels the path frames need, within
+		settings.texture_budget MB if it is not 0
+	*/
+	void uploadPathTextures()
+	{
+		vkglTF::Model &model = models.scene;
+		if (!model.deferTextureUpload) {
+			return;
+		}
+		auto tStart = std::chrono::high_resolution_clock::now();
+		const float pixelScale = 0.5f * static_cast<float>(height) * std::abs(camera.matrices.perspective[1][1]);
+		const VkDeviceSize budget = VkDeviceSize(settings.texture_budget) * 1024 * 1024;
+		const std::vector<glm::mat4> viewProjections = pathViewProjections();
+		std::vector<uint32_t> skipLevels(model.textures.size(), 0);
+		if (!viewProjections.empty()) {
+			skipLevels = model.planTextureResidency(viewProjections, pixelScale, budget);
+		}
+		VkDeviceSize fullSize = 0, residentSize = 0;
+		for (size_t i = 0; i < model.textures.size(); i++) {
+			fullSize += vkglTF::Texture::residentSize(model.textures[i].width, model.textures[i].height, 0);
+			residentSize += vkglTF::Texture::residentSize(model.textures[i].width, model.textures[i].height, skipLevels[i]);
+		}
+		model.uploadTextures(skipLevels, queue);
+		auto tEnd = std::chrono::high_resolution_clock::now();
+		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		std::cout << "Texture residency took " << tDiff << " ms, uploaded " << residentSize / (1024 * 1024) << " of " << fullSize / (1024 * 1024)
+			<< " MB of " << model.textures.size() << " textures" << std::endl;
+	}
+
+	// Make the precomputed visible draws of a path frame the ones drawn by the next submission
+	void applyPathVisibility(uint32_t frame)
+	{
+		if (frame >= pathVisibility.frameCount()) {
+			return;
+		}
+		pathVisibility.decode(frame, pathVisible);
+		if (useIndirectDraws()) {
+			models.scene.setIndirectVisibility(pathVisible);
+		}
 	}
 
 	void loadEnvironment(std::string filename)
@@ -645,28 +1405,45 @@ public:
 		loadEnvironment(envMapFile.c_str());
 	}
 
-	void setupNodeDescriptorSet(vkglTF::Node *node) {
-		if (node->mesh) {
-			VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
-			descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-			descriptorSetAllocInfo.descriptorPool = descriptorPool;
-			descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayouts.node;
-			descriptorSetAllocInfo.descriptorSetCount = 1;
-			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, &node->mesh->uniformBuffer.descriptorSet));
-
-			VkWriteDescriptorSet writeDescriptorSet{};
+	// One set per model, individual meshes are selected with a dynamic offset into the node buffer
+	void setupNodeDescriptorSet(vkglTF::Model &model) {
+		VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+		descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descriptorSetAllocInfo.descriptorPool = descriptorPool;
+		descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayouts.node;
+		descriptorSetAllocInfo.descriptorSetCount = 1;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, &model.nodeDescriptorSet));
+
+		std::array<VkWriteDescriptorSet, 5> writeDescriptorSets{};
+
+		writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		writeDescriptorSets[0].descriptorCount = 1;
+		writeDescriptorSets[0].dstSet = model.nodeDescriptorSet;
+		writeDescriptorSets[0].dstBinding = 0;
+		writeDescriptorSets[0].pBufferInfo = &model.nodeBuffer.descriptor;
+
+		writeDescriptorSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writeDescriptorSets[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writeDescriptorSets[1].descriptorCount = 1;
+		writeDescriptorSets[1].dstSet = model.nodeDescriptorSet;
+		writeDescriptorSets[1].dstBinding = 1;
+		writeDescriptorSets[1].pBufferInfo = &model.jointBuffer.descriptor;
+
+		// Indirect draws read draw data, node blocks and materials from storage buffers
+		const VkDescriptorBufferInfo nodeBlocks = { model.nodeBuffer.buffer, 0, VK_WHOLE_SIZE };
+		const VkDescriptorBufferInfo *storageBuffers[] = { &model.drawDataBuffer.descriptor, &nodeBlocks, &materialBuffer.descriptor };
+		for (uint32_t i = 0; i < 3; i++) {
+			VkWriteDescriptorSet &writeDescriptorSet = writeDescriptorSets[2 + i];
 			writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 			writeDescriptorSet.descriptorCount = 1;
-			writeDescriptorSet.dstSet = node->mesh->uniformBuffer.descriptorSet;
-			writeDescriptorSet.dstBinding = 0;
-			writeDescriptorSet.pBufferInfo = &node->mesh->uniformBuffer.descriptor;
-
-			vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, nullptr);
-		}
-		for (auto& child : node->children) {
-			setupNodeDescriptorSet(child);
+			writeDescriptorSet.dstSet = model.nodeDescriptorSet;
+			writeDescriptorSet.dstBinding = 2 + i;
+			writeDescriptorSet.pBufferInfo = storageBuffers[i];
 		}
+
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
 	}
 
 	void setupDescriptors()
@@ -676,11 +1453,15 @@ public:
 		*/
 		uint32_t imageSamplerCount = 0;
 		uint32_t materialCount = 0;
-		uint32_t meshCount = 0;
 
 		// Environment samplers (radiance, irradiance, brdf lut)
 		imageSamplerCount += 3;
 
+		bindless = supportsBindless();
+		if (settings.bindless && !bindless) {
+			std::cout << "Bindless materials are not supported for this scene and device, using per material descriptor sets" << std::endl;
+		}
+
 		std::vector<vkglTF::Model*> modellist = { &models.skybox, &models.scene };
 		for (auto &model : modellist) {
 		  /* for (auto &material : model->materials) {
@@ -688,13 +1469,9 @@ public:
 				imageSamplerCount += 5;
 				materialCount++;
 				} */
-			imageSamplerCount += 5 * model->materials.size();
-			materialCount += model->materials.size();
-			
-			for (auto node : model->linearNodes) {
-				if (node->mesh) {
-					meshCount++;
-				}
+			if (!bindless) {
+				imageSamplerCount += 5 * model->materials.size();
+				materialCount += model->materials.size();
 			}
 		}
 
@@ -704,16 +1481,25 @@ public:
 		int num_images = 1;
 #endif // WITH_DISPLAY
 
+		// The bindless set holds every scene model texture once, independent of the material count
+		bindlessTextureCount = static_cast<uint32_t>(models.scene.textures.size()) + 1;
+		if (bindless) {
+			materialCount = 1;
+		}
+
 		std::vector<VkDescriptorPoolSize> poolSizes = {
-			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, (4 + meshCount) * num_images },
-			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageSamplerCount * num_images }
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, static_cast<uint32_t>(4 * num_images) },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageSamplerCount * num_images + (bindless ? bindlessTextureCount : 0) },
+			// Node set of the scene model
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 }
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolCI{};
 		descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		descriptorPoolCI.poolSizeCount = 2;
+		descriptorPoolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 		descriptorPoolCI.pPoolSizes = poolSizes.data();
-		descriptorPoolCI.maxSets = (2 + materialCount + meshCount) * num_images;
+		descriptorPoolCI.maxSets = (2 + materialCount) * num_images + 1;
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCI, nullptr, &descriptorPool));
 
 		/*
@@ -785,8 +1571,39 @@ public:
 			}
 		}
 
+		// Bindless material textures, indexed with the material's texture indices
+		if (bindless) {
+			VkDescriptorSetLayoutBinding setLayoutBinding = { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, bindlessTextureCount, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr };
+			VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
+			descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			descriptorSetLayoutCI.pBindings = &setLayoutBinding;
+			descriptorSetLayoutCI.bindingCount = 1;
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.material));
+
+			VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+			descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			descriptorSetAllocInfo.descriptorPool = descriptorPool;
+			descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayouts.material;
+			descriptorSetAllocInfo.descriptorSetCount = 1;
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, &bindlessDescriptorSet));
+
+			std::vector<VkDescriptorImageInfo> imageDescriptors = { textures.empty.descriptor };
+			for (const vkglTF::Texture &texture : models.scene.textures) {
+				imageDescriptors.push_back(texture.descriptor);
+			}
+
+			VkWriteDescriptorSet writeDescriptorSet{};
+			writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			writeDescriptorSet.descriptorCount = bindlessTextureCount;
+			writeDescriptorSet.dstSet = bindlessDescriptorSet;
+			writeDescriptorSet.dstBinding = 0;
+			writeDescriptorSet.pImageInfo = imageDescriptors.data();
+			vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, nullptr);
+		}
+
 		// Material (samplers)
-		{
+		if (!bindless) {
 			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
 				{ 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
 				{ 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
@@ -809,32 +1626,9 @@ public:
 				descriptorSetAllocInfo.descriptorSetCount = 1;
 				VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, &material.descriptorSet));
 
-				std::vector<VkDescriptorImageInfo> imageDescriptors = {
-					textures.empty.descriptor,
-					textures.empty.descriptor,
-					material.normalTexture ? material.normalTexture->descriptor : textures.empty.descriptor,
-					material.occlusionTexture ? material.occlusionTexture->descriptor : textures.empty.descriptor,
-					material.emissiveTexture ? material.emissiveTexture->descriptor : textures.empty.descriptor
-				};
-
-				// TODO: glTF specs states that metallic roughness should be preferred, even if specular glosiness is present
-
-				if (material.pbrWorkflows.metallicRoughness) {
-					if (material.baseColorTexture) {
-						imageDescriptors[0] = material.baseColorTexture->descriptor;
-					}
-					if (material.metallicRoughnessTexture) {
-						imageDescriptors[1] = material.metallicRoughnessTexture->descriptor;
-					}
-				}
-
-				if (material.pbrWorkflows.specularGlossiness) {
-					if (material.extension.diffuseTexture) {
-						imageDescriptors[0] = material.extension.diffuseTexture->descriptor;
-					}
-					if (material.extension.specularGlossinessTexture) {
-						imageDescriptors[1] = material.extension.specularGlossinessTexture->descriptor;
-					}
+				std::vector<VkDescriptorImageInfo> imageDescriptors;
+				for (const vkglTF::Texture *texture : materialTextures(material)) {
+					imageDescriptors.push_back(texture ? texture->descriptor : textures.empty.descriptor);
 				}
 
 				std::array<VkWriteDescriptorSet, 5> writeDescriptorSets{};
@@ -849,24 +1643,25 @@ public:
 
 				vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
 			}
+		}
 
-			// Model node (matrices)
-			{
-				std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-					{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr },
-				};
-				VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
-				descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-				descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
-				descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
-				VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.node));
-
-				// Per-Node descriptor set
-				for (auto &node : models.scene.nodes) {
-					setupNodeDescriptorSet(node);
-				}
-			}
+		// Model node (matrices), used by the direct and the bindless pipelines alike
+		{
+			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+				{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr },
+				{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr },
+				{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr },
+				{ 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr },
+				{ 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
+			};
+			VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
+			descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
+			descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.node));
 
+			// Shared descriptor set for all nodes
+			setupNodeDescriptorSet(models.scene);
 		}
 
 		// Skybox (fixed set)
@@ -1028,14 +1823,51 @@ public:
 		}
 
 		// PBR pipeline
+		std::string vertexShader = "pbr.vert.spv";
+		std::string fragmentShader = "pbr_khr.frag.spv";
 		shaderStages = {
-			loadShader(device, "pbr.vert.spv", VK_SHADER_STAGE_VERTEX_BIT),
-			loadShader(device, "pbr_khr.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT)
+			loadShader(device, vertexShader, VK_SHADER_STAGE_VERTEX_BIT),
+			loadShader(device, fragmentShader, VK_SHADER_STAGE_FRAGMENT_BIT)
 		};
 		depthStencilStateCI.depthWriteEnable = VK_TRUE;
 		depthStencilStateCI.depthTestEnable = VK_TRUE;
 
-		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.pbr));
+		FragmentSpecialization fragmentSpecialization = { bindlessTextureCount, 0, PERMUTATION_DYNAMIC };
+		const VkSpecializationInfo specializationInfo = fragmentSpecializationInfo(fragmentSpecialization);
+		featurePipelines.assign(num_available_features, FeaturePipelines());
+
+		/*
+			Create a PBR pipeline with the current state, and its variant for every requested feature buffer
+			After the depth pre-pass, opaque and masked draws only shade the fragments that ended up visible
+			With material permutations the state is also kept to specialize the pipeline per permutation later on
+		*/
+		auto createPbrPipelines = [&](VkPipeline *pipeline, VkPipeline FeaturePipelines::*variant, bool prepassed, bool blend, bool indirect) {
+			if (prepassed && settings.depth_prepass) {
+				depthStencilStateCI.depthCompareOp = VK_COMPARE_OP_EQUAL;
+				depthStencilStateCI.depthWriteEnable = VK_FALSE;
+			}
+			if (settings.material_permutations) {
+				pbrPipelineStates[pbrPipelineKind(blend, indirect)].capture(pipelineCI, vertexShader, fragmentShader);
+			}
+			shaderStages[1].pSpecializationInfo = &specializationInfo;
+			fragmentSpecialization.feature = 0;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, pipeline));
+			for (const std::string &name : settings.feature_buffers) {
+				const int feature = featureIndex(name);
+				if (feature <= 0 || featurePipelines[feature].*variant != VK_NULL_HANDLE) {
+					continue;
+				}
+				fragmentSpecialization.feature = feature;
+				VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &(featurePipelines[feature].*variant)));
+			}
+			depthStencilStateCI.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+			depthStencilStateCI.depthWriteEnable = VK_TRUE;
+		};
+
+		// With bindless materials set 1 only holds the texture array, the scene is drawn by the indirect variants alone
+		if (!bindless) {
+			createPbrPipelines(&pipelines.pbr, &FeaturePipelines::pbr, true, false, false);
+		}
 
 		rasterizationStateCI.cullMode = VK_CULL_MODE_NONE;
 		blendAttachmentState.blendEnable = VK_TRUE;
@@ -1047,12 +1879,80 @@ public:
 		blendAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
 		blendAttachmentState.alphaBlendOp = VK_BLEND_OP_ADD;
 
-		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.pbrAlphaBlend));
+		if (!bindless) {
+			createPbrPipelines(&pipelines.pbrAlphaBlend, &FeaturePipelines::pbrAlphaBlend, false, true, false);
+		}
 		
 
 		for (auto shaderStage : shaderStages) {
 			vkDestroyShaderModule(device, shaderStage.module, nullptr);
 		}
+
+		// Indirect draw variants, the draw index is passed as firstInstance
+		if (settings.indirect_draw) {
+			if (vulkanDevice->enabledFeatures.drawIndirectFirstInstance) {
+				vertexShader = "pbr_indirect.vert.spv";
+				fragmentShader = bindless ? "pbr_khr_bindless.frag.spv" : "pbr_khr_indirect.frag.spv";
+				shaderStages = {
+					loadShader(device, vertexShader, VK_SHADER_STAGE_VERTEX_BIT),
+					loadShader(device, fragmentShader, VK_SHADER_STAGE_FRAGMENT_BIT)
+				};
+				createPbrPipelines(&pipelines.pbrAlphaBlendIndirect, &FeaturePipelines::pbrAlphaBlendIndirect, false, true, true);
+
+				rasterizationStateCI.cullMode = VK_CULL_MODE_BACK_BIT;
+				blendAttachmentState.blendEnable = VK_FALSE;
+				createPbrPipelines(&pipelines.pbrIndirect, &FeaturePipelines::pbrIndirect, true, false, true);
+
+				for (auto shaderStage : shaderStages) {
+					vkDestroyShaderModule(device, shaderStage.module, nullptr);
+				}
+			} else {
+				std::cout << "drawIndirectFirstInstance is not supported, drawing the scene directly" << std::endl;
+			}
+		}
+
+		// Depth pre-pass pipelines without color writes, reading only the vertex attributes that affect depth
+		if (settings.depth_prepass) {
+			rasterizationStateCI.cullMode = VK_CULL_MODE_BACK_BIT;
+			blendAttachmentState.blendEnable = VK_FALSE;
+			blendAttachmentState.colorWriteMask = 0;
+			const std::vector<VkVertexInputAttributeDescription> depthAttributes = {
+				vertexInputAttributes[0], vertexInputAttributes[4], vertexInputAttributes[5]
+			};
+			const std::vector<VkVertexInputAttributeDescription> maskAttributes = {
+				vertexInputAttributes[0], vertexInputAttributes[2], vertexInputAttributes[3], vertexInputAttributes[4], vertexInputAttributes[5]
+			};
+			const bool indirect = useIndirectDraws();
+			const bool direct = !bindless;
+			for (int variant = 0; variant < 2; variant++) {
+				if (variant == 0 ? !direct : !indirect) {
+					continue;
+				}
+				const std::string suffix = variant == 0 ? "" : "_indirect";
+				// Opaque: positions only, no fragment shader
+				vertexInputStateCI.vertexAttributeDescriptionCount = static_cast<uint32_t>(depthAttributes.size());
+				vertexInputStateCI.pVertexAttributeDescriptions = depthAttributes.data();
+				shaderStages[0] = loadShader(device, "pbr_depth" + suffix + ".vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+				pipelineCI.stageCount = 1;
+				VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, variant == 0 ? &pipelines.pbrDepth : &pipelines.pbrDepthIndirect));
+				vkDestroyShaderModule(device, shaderStages[0].module, nullptr);
+
+				// Masked: positions and UVs, the fragment shader only runs the alpha test
+				vertexInputStateCI.vertexAttributeDescriptionCount = static_cast<uint32_t>(maskAttributes.size());
+				vertexInputStateCI.pVertexAttributeDescriptions = maskAttributes.data();
+				shaderStages = {
+					loadShader(device, "pbr_depth_mask" + suffix + ".vert.spv", VK_SHADER_STAGE_VERTEX_BIT),
+					loadShader(device, variant == 0 ? "pbr_khr_depth_mask.frag.spv" : bindless ? "pbr_khr_depth_mask_bindless.frag.spv" : "pbr_khr_depth_mask_indirect.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT)
+				};
+				fragmentSpecialization.feature = 0;
+				shaderStages[1].pSpecializationInfo = &specializationInfo;
+				pipelineCI.stageCount = 2;
+				VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, variant == 0 ? &pipelines.pbrDepthMask : &pipelines.pbrDepthMaskIndirect));
+				for (auto shaderStage : shaderStages) {
+					vkDestroyShaderModule(device, shaderStage.module, nullptr);
+				}
+			}
+		}
 	}
 
 	/*
@@ -1897,20 +2797,7 @@ public:
 		shaderValuesScene.projection = camera.matrices.perspective;
 		shaderValuesScene.view = camera.matrices.view;
 		
-		// Center and scale model
-		// float scale = (1.0f / std::max(models.scene.aabb[0][0], std::max(models.scene.aabb[1][1], models.scene.aabb[2][2]))) * 0.5f;
-		// Nope
-		float scale = 1.0f;
-		// And nope
-		//glm::vec3 translate = -glm::vec3(models.scene.aabb[3][0], models.scene.aabb[3][1], models.scene.aabb[3][2]);
-		// translate += -0.5f * glm::vec3(models.scene.aabb[0][0], models.scene.aabb[1][1], models.scene.aabb[2][2]);
-		glm::vec3 translate = glm::vec3(0.0f);
-
-		shaderValuesScene.model = glm::mat4(1.0f);
-		shaderValuesScene.model[0][0] = scale; // Mirror fix
-		shaderValuesScene.model[1][1] = scale;
-		shaderValuesScene.model[2][2] = scale; // Se if we can fix mirroring issue
-		shaderValuesScene.model = glm::translate(shaderValuesScene.model, translate);
+		shaderValuesScene.model = sceneModelMatrix();
 
 		shaderValuesScene.camPos = glm::vec3(
 			camera.position.z * sin(glm::radians(camera.rotation.y)) * cos(glm::radians(camera.rotation.x)),
@@ -1924,6 +2811,24 @@ public:
 		shaderValuesSkybox.model = glm::mat4(glm::mat3(camera.matrices.view));
 	}
 
+	glm::mat4 sceneModelMatrix() const
+	{
+		// Center and scale model
+		// float scale = (1.0f / std::max(models.scene.aabb[0][0], std::max(models.scene.aabb[1][1], models.scene.aabb[2][2]))) * 0.5f;
+		// Nope
+		float scale = 1.0f;
+		// And nope
+		//glm::vec3 translate = -glm::vec3(models.scene.aabb[3][0], models.scene.aabb[3][1], models.scene.aabb[3][2]);
+		// translate += -0.5f * glm::vec3(models.scene.aabb[0][0], models.scene.aabb[1][1], models.scene.aabb[2][2]);
+		glm::vec3 translate = glm::vec3(0.0f);
+
+		glm::mat4 model = glm::mat4(1.0f);
+		model[0][0] = scale; // Mirror fix
+		model[1][1] = scale;
+		model[2][2] = scale; // Se if we can fix mirroring issue
+		return glm::translate(model, translate);
+	}
+
 	void updateParams()
 	{
 		shaderValuesParams.lightDir = glm::vec4(
@@ -1947,6 +2852,15 @@ public:
 	{
 		VulkanExampleBase::prepare();
 
+		// Bound the queue so pending frames cannot pile up in memory if the disk falls behind
+		const size_t writerThreads = settings.writer_threads > 0 ? settings.writer_threads : std::max(1u, std::thread::hardware_concurrency());
+		writerPool.setThreadCount(writerThreads, 2 * writerThreads);
+		// The render thread takes part in parallel updates, so the pool only needs the remaining threads
+		const size_t updateThreads = settings.update_threads > 0 ? settings.update_threads : std::max(1u, std::thread::hardware_concurrency());
+		if (updateThreads > 1) {
+			updatePool.setThreadCount(updateThreads - 1);
+		}
+
 		// camera.type = Camera::CameraType::lookat;
 		camera.type = Camera::CameraType::firstperson;
 
@@ -1999,9 +2913,11 @@ public:
 		prepareUniformBuffers();
 		setupDescriptors();
 		setupCustomStuff();
+		setupComputeDeform();
 
 		
 		preparePipelines();
+		setupGpuCulling();
 
 #ifdef WITH_DISPLAY
 		ui = new UI(vulkanDevice, renderPass, queue, pipelineCache, settings.sampleCount);
@@ -2104,6 +3020,544 @@ public:
 	vkCmdPipelineBarrier(cmd, srcStages, destStages, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
     }
 
+	/*
+		Vertex deformation pre-pass
+		All morphed and compute skinned vertex ranges of the scene are deformed into the model's deformed vertex buffer
+		with one dispatch per range. The command buffer is recorded once and only resubmitted when the pose changes
+	*/
+	void setupComputeDeform()
+	{
+		vkglTF::Model &model = models.scene;
+		if (model.deformRanges.empty()) {
+			return;
+		}
+
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			{ 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+		};
+		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
+		descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
+		descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCI, nullptr, &computeDeform.descriptorSetLayout));
+
+		VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, static_cast<uint32_t>(setLayoutBindings.size()) };
+		VkDescriptorPoolCreateInfo descriptorPoolCI{};
+		descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		descriptorPoolCI.poolSizeCount = 1;
+		descriptorPoolCI.pPoolSizes = &poolSize;
+		descriptorPoolCI.maxSets = 1;
+		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCI, nullptr, &computeDeform.descriptorPool));
+
+		VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+		descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descriptorSetAllocInfo.descriptorPool = computeDeform.descriptorPool;
+		descriptorSetAllocInfo.pSetLayouts = &computeDeform.descriptorSetLayout;
+		descriptorSetAllocInfo.descriptorSetCount = 1;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, &computeDeform.descriptorSet));
+
+		const VkDescriptorBufferInfo bufferInfos[5] = {
+			{ model.vertices.buffer, 0, VK_WHOLE_SIZE },
+			{ model.deformedVertices.buffer, 0, VK_WHOLE_SIZE },
+			model.jointBuffer.descriptor,
+			{ model.morphDeltaBuffer.buffer, 0, VK_WHOLE_SIZE },
+			model.morphWeightBuffer.descriptor
+		};
+		std::array<VkWriteDescriptorSet, 5> writeDescriptorSets{};
+		for (size_t i = 0; i < writeDescriptorSets.size(); i++) {
+			writeDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeDescriptorSets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writeDescriptorSets[i].descriptorCount = 1;
+			writeDescriptorSets[i].dstSet = computeDeform.descriptorSet;
+			writeDescriptorSets[i].dstBinding = static_cast<uint32_t>(i);
+			writeDescriptorSets[i].pBufferInfo = &bufferInfos[i];
+		}
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.size = sizeof(vkglTF::Model::DeformRange);
+		VkPipelineLayoutCreateInfo pipelineLayoutCI{};
+		pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutCI.setLayoutCount = 1;
+		pipelineLayoutCI.pSetLayouts = &computeDeform.descriptorSetLayout;
+		pipelineLayoutCI.pushConstantRangeCount = 1;
+		pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &computeDeform.pipelineLayout));
+
+		VkComputePipelineCreateInfo pipelineCI{};
+		pipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineCI.layout = computeDeform.pipelineLayout;
+		pipelineCI.stage = loadShader(device, "deform.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &computeDeform.pipeline));
+		vkDestroyShaderModule(device, pipelineCI.stage.module, nullptr);
+
+		VkFenceCreateInfo fenceCI{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, VK_FENCE_CREATE_SIGNALED_BIT };
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCI, nullptr, &computeDeform.fence));
+
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
+		cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdBufAllocateInfo.commandPool = cmdPool;
+		cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		cmdBufAllocateInfo.commandBufferCount = 1;
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &computeDeform.commandBuffer));
+
+		VkCommandBuffer cb = computeDeform.commandBuffer;
+		VkCommandBufferBeginInfo cmdBufferBeginInfo{};
+		cmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(cb, &cmdBufferBeginInfo));
+
+		// Previous draws must be done reading the deformed vertices before they are overwritten
+		vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, computeDeform.pipeline);
+		vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, computeDeform.pipelineLayout, 0, 1, &computeDeform.descriptorSet, 0, nullptr);
+		for (auto &range : model.deformRanges) {
+			vkCmdPushConstants(cb, computeDeform.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(range), &range);
+			vkCmdDispatch(cb, (range.vertexCount + 63) / 64, 1, 1);
+		}
+
+		// Make the deformed vertices visible to all following draws
+		VkBufferMemoryBarrier bufferBarrier{};
+		bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.buffer = model.deformedVertices.buffer;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+		VK_CHECK_RESULT(vkEndCommandBuffer(cb));
+	}
+
+	void setupGpuCulling()
+	{
+		vkglTF::Model &model = models.scene;
+		if (!settings.gpu_culling || !useIndirectDraws() || model.drawList.empty()) {
+			return;
+		}
+
+		VkFormatProperties depthFormatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, depthFormat, &depthFormatProperties);
+		gpuCulling.occlusion = settings.occlusion_culling && settings.sampleCount == VK_SAMPLE_COUNT_1_BIT
+			&& (depthFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+		if (settings.occlusion_culling && !gpuCulling.occlusion) {
+			std::cout << "Occlusion culling needs a single sampled depth buffer that can be sampled, culling the frustum only" << std::endl;
+		}
+		if (gpuCulling.occlusion) {
+			setupDepthPyramid();
+		}
+
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			{ 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 6, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+		};
+		if (gpuCulling.occlusion) {
+			setLayoutBindings.push_back({ 7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr });
+			setLayoutBindings.push_back({ 8, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr });
+		}
+		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
+		descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
+		descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCI, nullptr, &gpuCulling.descriptorSetLayout));
+
+		// One set per culling phase
+		const uint32_t setCount = gpuCulling.occlusion ? 2 : 1;
+		const std::vector<VkDescriptorPoolSize> poolSizes = {
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7 * setCount },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, setCount },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount }
+		};
+		VkDescriptorPoolCreateInfo descriptorPoolCI{};
+		descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		descriptorPoolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		descriptorPoolCI.pPoolSizes = poolSizes.data();
+		descriptorPoolCI.maxSets = setCount;
+		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCI, nullptr, &gpuCulling.descriptorPool));
+
+		const VkDescriptorSetLayout setLayouts[2] = { gpuCulling.descriptorSetLayout, gpuCulling.descriptorSetLayout };
+		VkDescriptorSet descriptorSets[2];
+		VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+		descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descriptorSetAllocInfo.descriptorPool = gpuCulling.descriptorPool;
+		descriptorSetAllocInfo.pSetLayouts = setLayouts;
+		descriptorSetAllocInfo.descriptorSetCount = setCount;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, descriptorSets));
+		gpuCulling.descriptorSet = descriptorSets[0];
+		gpuCulling.lateDescriptorSet = descriptorSets[setCount - 1];
+
+		const VkDeviceSize commandsSize = model.drawList.size() * sizeof(VkDrawIndexedIndirectCommand);
+		const VkDeviceSize countersSize = (2 + model.drawBatches.size()) * sizeof(uint32_t);
+		gpuCulling.commands.create(vulkanDevice, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, commandsSize, false);
+		gpuCulling.counters.create(vulkanDevice, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, countersSize);
+		gpuCulling.params.create(vulkanDevice, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, sizeof(CullParams));
+		VkDescriptorBufferInfo visibilityInfo{};
+		if (gpuCulling.occlusion) {
+			gpuCulling.lateCommands.create(vulkanDevice, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, commandsSize, false);
+			gpuCulling.lateCounters.create(vulkanDevice, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, countersSize);
+			gpuCulling.visibility.create(vulkanDevice, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, model.drawList.size() * sizeof(uint32_t), false);
+			visibilityInfo = gpuCulling.visibility.descriptor;
+
+			// Everything counts as visible before the first frame, so its early phase draws all draws in the frustum
+			VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			vkCmdFillBuffer(copyCmd, gpuCulling.visibility.buffer, 0, VK_WHOLE_SIZE, 1);
+			vulkanDevice->flushCommandBuffer(copyCmd, queue, true);
+		}
+
+		const VkDescriptorImageInfo pyramidInfo = { depthPyramid.sampler, gpuCulling.occlusion ? depthPyramid.view : VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL };
+		for (uint32_t set = 0; set < setCount; set++) {
+			const bool late = set == 1;
+			const VkDescriptorBufferInfo bufferInfos[8] = {
+				model.drawCommandBuffer.descriptor,
+				late ? gpuCulling.lateCommands.descriptor : gpuCulling.commands.descriptor,
+				model.drawCullBuffer.descriptor,
+				model.drawDataBuffer.descriptor,
+				{ model.nodeBuffer.buffer, 0, VK_WHOLE_SIZE },
+				late ? gpuCulling.lateCounters.descriptor : gpuCulling.counters.descriptor,
+				gpuCulling.params.descriptor,
+				visibilityInfo
+			};
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets(setLayoutBindings.size());
+			for (size_t i = 0; i < writeDescriptorSets.size(); i++) {
+				writeDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writeDescriptorSets[i].descriptorType = setLayoutBindings[i].descriptorType;
+				writeDescriptorSets[i].descriptorCount = 1;
+				writeDescriptorSets[i].dstSet = descriptorSets[set];
+				writeDescriptorSets[i].dstBinding = static_cast<uint32_t>(i);
+				if (setLayoutBindings[i].descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
+					writeDescriptorSets[i].pImageInfo = &pyramidInfo;
+				} else {
+					writeDescriptorSets[i].pBufferInfo = &bufferInfos[i];
+				}
+			}
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+		}
+
+		// The occlusion culling shader is told its phase by a push constant
+		const VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t) };
+		VkPipelineLayoutCreateInfo pipelineLayoutCI{};
+		pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutCI.setLayoutCount = 1;
+		pipelineLayoutCI.pSetLayouts = &gpuCulling.descriptorSetLayout;
+		if (gpuCulling.occlusion) {
+			pipelineLayoutCI.pushConstantRangeCount = 1;
+			pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+		}
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &gpuCulling.pipelineLayout));
+
+		VkComputePipelineCreateInfo pipelineCI{};
+		pipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineCI.layout = gpuCulling.pipelineLayout;
+		pipelineCI.stage = loadShader(device, gpuCulling.occlusion ? "cull_occlusion.comp.spv" : "cull.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &gpuCulling.pipeline));
+		vkDestroyShaderModule(device, pipelineCI.stage.module, nullptr);
+	}
+
+	/*
+		Depth pyramid for occlusion culling
+		Each level is written through its own storage view by one dispatch of depthpyramid.comp, reading the previous
+		level or, for level 0, the depth aspect of the scene's depth attachment. The whole chain stays in the general layout
+	*/
+	void setupDepthPyramid()
+	{
+		// Powers of two, so every level exactly halves the previous one
+		depthPyramid.width = 1;
+		depthPyramid.height = 1;
+		while (depthPyramid.width * 2 <= width) {
+			depthPyramid.width *= 2;
+		}
+		while (depthPyramid.height * 2 <= height) {
+			depthPyramid.height *= 2;
+		}
+		depthPyramid.levels = 1;
+		while ((std::max(depthPyramid.width, depthPyramid.height) >> depthPyramid.levels) > 0) {
+			depthPyramid.levels++;
+		}
+
+		VkImageCreateInfo imageCI{};
+		imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.format = VK_FORMAT_R32_SFLOAT;
+		imageCI.extent = { depthPyramid.width, depthPyramid.height, 1 };
+		imageCI.mipLevels = depthPyramid.levels;
+		imageCI.arrayLayers = 1;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		imageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &depthPyramid.image));
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, depthPyramid.image, &memReqs);
+		VkMemoryAllocateInfo memAllocInfo{};
+		memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		memAllocInfo.allocationSize = memReqs.size;
+		memAllocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(device, &memAllocInfo, nullptr, &depthPyramid.memory));
+		VK_CHECK_RESULT(vkBindImageMemory(device, depthPyramid.image, depthPyramid.memory, 0));
+
+		VkImageViewCreateInfo viewCI{};
+		viewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCI.image = depthPyramid.image;
+		viewCI.format = VK_FORMAT_R32_SFLOAT;
+		viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, depthPyramid.levels, 0, 1 };
+		VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &depthPyramid.view));
+		depthPyramid.levelViews.resize(depthPyramid.levels);
+		for (uint32_t level = 0; level < depthPyramid.levels; level++) {
+			viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+			VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &depthPyramid.levelViews[level]));
+		}
+		viewCI.image = customStuff.fbDepth.image;
+		viewCI.format = depthFormat;
+		viewCI.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+		VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &depthPyramid.depthView));
+
+		VkSamplerCreateInfo samplerCI{};
+		samplerCI.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerCI.magFilter = VK_FILTER_NEAREST;
+		samplerCI.minFilter = VK_FILTER_NEAREST;
+		samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.maxLod = static_cast<float>(depthPyramid.levels);
+		samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		VK_CHECK_RESULT(vkCreateSampler(device, &samplerCI, nullptr, &depthPyramid.sampler));
+
+		const std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			{ 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+		};
+		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
+		descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
+		descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCI, nullptr, &depthPyramid.descriptorSetLayout));
+
+		const std::vector<VkDescriptorPoolSize> poolSizes = {
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthPyramid.levels },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, depthPyramid.levels }
+		};
+		VkDescriptorPoolCreateInfo descriptorPoolCI{};
+		descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		descriptorPoolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		descriptorPoolCI.pPoolSizes = poolSizes.data();
+		descriptorPoolCI.maxSets = depthPyramid.levels;
+		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCI, nullptr, &depthPyramid.descriptorPool));
+
+		const std::vector<VkDescriptorSetLayout> setLayouts(depthPyramid.levels, depthPyramid.descriptorSetLayout);
+		depthPyramid.descriptorSets.resize(depthPyramid.levels);
+		VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+		descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descriptorSetAllocInfo.descriptorPool = depthPyramid.descriptorPool;
+		descriptorSetAllocInfo.pSetLayouts = setLayouts.data();
+		descriptorSetAllocInfo.descriptorSetCount = depthPyramid.levels;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, depthPyramid.descriptorSets.data()));
+		for (uint32_t level = 0; level < depthPyramid.levels; level++) {
+			const VkDescriptorImageInfo inputInfo = level == 0
+				? VkDescriptorImageInfo{ depthPyramid.sampler, depthPyramid.depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL }
+				: VkDescriptorImageInfo{ depthPyramid.sampler, depthPyramid.levelViews[level - 1], VK_IMAGE_LAYOUT_GENERAL };
+			const VkDescriptorImageInfo outputInfo = { VK_NULL_HANDLE, depthPyramid.levelViews[level], VK_IMAGE_LAYOUT_GENERAL };
+			std::array<VkWriteDescriptorSet, 2> writeDescriptorSets{};
+			for (size_t i = 0; i < writeDescriptorSets.size(); i++) {
+				writeDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writeDescriptorSets[i].descriptorType = setLayoutBindings[i].descriptorType;
+				writeDescriptorSets[i].descriptorCount = 1;
+				writeDescriptorSets[i].dstSet = depthPyramid.descriptorSets[level];
+				writeDescriptorSets[i].dstBinding = static_cast<uint32_t>(i);
+				writeDescriptorSets[i].pImageInfo = i == 0 ? &inputInfo : &outputInfo;
+			}
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+		}
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCI{};
+		pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutCI.setLayoutCount = 1;
+		pipelineLayoutCI.pSetLayouts = &depthPyramid.descriptorSetLayout;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &depthPyramid.pipelineLayout));
+
+		VkComputePipelineCreateInfo pipelineCI{};
+		pipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineCI.layout = depthPyramid.pipelineLayout;
+		pipelineCI.stage = loadShader(device, "depthpyramid.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &depthPyramid.pipeline));
+		vkDestroyShaderModule(device, pipelineCI.stage.module, nullptr);
+
+		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		VkImageMemoryBarrier imageBarrier{};
+		imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = depthPyramid.image;
+		imageBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, depthPyramid.levels, 0, 1 };
+		vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+		vulkanDevice->flushCommandBuffer(copyCmd, queue, true);
+	}
+
+	// Reduce the depth of the early draws into the depth pyramid, between the two render passes of the scene
+	void recordDepthPyramid(VkCommandBuffer cb)
+	{
+		VkImageMemoryBarrier depthBarrier{};
+		depthBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		depthBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		depthBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		depthBarrier.image = customStuff.fbDepth.image;
+		depthBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		if (depthFormat >= VK_FORMAT_D16_UNORM_S8_UINT) {
+			depthBarrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+		}
+		depthBarrier.subresourceRange.levelCount = 1;
+		depthBarrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+
+		// Each level reads the one before it, the last one is followed by the late culling phase
+		VkMemoryBarrier memoryBarrier{};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramid.pipeline);
+		for (uint32_t level = 0; level < depthPyramid.levels; level++) {
+			vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramid.pipelineLayout, 0, 1, &depthPyramid.descriptorSets[level], 0, nullptr);
+			const uint32_t levelWidth = std::max(1u, depthPyramid.width >> level);
+			const uint32_t levelHeight = std::max(1u, depthPyramid.height >> level);
+			vkCmdDispatch(cb, (levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+			vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		// The late draws continue on the same depth attachment
+		depthBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, 0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+	}
+
+	/*
+		Clear the compacted commands and counters of a culling phase, then cull all draws into them
+		Recorded ahead of the scene's render pass, the frustum itself is read from gpuCulling.params
+	*/
+	void recordCulling(VkCommandBuffer cb, CullPhase phase = CULL_PHASE_ALL)
+	{
+		if (gpuCulling.pipeline == VK_NULL_HANDLE) {
+			return;
+		}
+		vkglTF::Model &model = models.scene;
+		const bool late = phase == CULL_PHASE_LATE;
+		const Buffer &commands = late ? gpuCulling.lateCommands : gpuCulling.commands;
+		const Buffer &counters = late ? gpuCulling.lateCounters : gpuCulling.counters;
+
+		// Previous frames must be done drawing from the compacted commands before they are cleared
+		vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+		vkCmdFillBuffer(cb, commands.buffer, 0, VK_WHOLE_SIZE, 0);
+		vkCmdFillBuffer(cb, counters.buffer, 0, VK_WHOLE_SIZE, 0);
+
+		VkMemoryBarrier memoryBarrier{};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, gpuCulling.pipeline);
+		vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, gpuCulling.pipelineLayout, 0, 1, late ? &gpuCulling.lateDescriptorSet : &gpuCulling.descriptorSet, 0, nullptr);
+		if (gpuCulling.occlusion) {
+			const uint32_t phaseIndex = phase;
+			vkCmdPushConstants(cb, gpuCulling.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(phaseIndex), &phaseIndex);
+		}
+		vkCmdDispatch(cb, (static_cast<uint32_t>(model.drawList.size()) + 63) / 64, 1, 1);
+
+		// Make the compacted commands visible to the indirect draws and the counters to the host
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Frustum of the current camera in the scene model's space, written before each frame's submission
+	void updateCullParams()
+	{
+		if (gpuCulling.pipeline == VK_NULL_HANDLE) {
+			return;
+		}
+		const glm::mat4 m = shaderValuesScene.projection * shaderValuesScene.view * shaderValuesScene.model;
+		CullParams params{};
+		// Same planes as the CPU culling path, with the near plane at z = 0 of the [0, 1] depth range
+		const vkglTF::Frustum frustum(m);
+		std::copy(frustum.planes, frustum.planes + 6, params.planes);
+		params.viewProjection = m;
+		params.drawCount = static_cast<uint32_t>(models.scene.drawList.size());
+		if (gpuCulling.occlusion) {
+			params.pyramidSize = glm::vec2(static_cast<float>(depthPyramid.width), static_cast<float>(depthPyramid.height));
+		}
+		memcpy(gpuCulling.params.mapped, &params, sizeof(params));
+	}
+
+	// Add the counters of the frame that just finished to cullStats
+	void readCullStats()
+	{
+		if (gpuCulling.pipeline == VK_NULL_HANDLE) {
+			return;
+		}
+		const uint32_t *counters = static_cast<const uint32_t*>(gpuCulling.counters.mapped);
+		cullStats.visible += counters[0];
+		cullStats.total += counters[1];
+		if (gpuCulling.occlusion) {
+			const uint32_t lateVisible = static_cast<const uint32_t*>(gpuCulling.lateCounters.mapped)[0];
+			cullStats.visible += lateVisible;
+			cullStats.late += lateVisible;
+		}
+		cullStats.frames++;
+	}
+
+	void printCullStats() const
+	{
+		if (cullStats.frames == 0) {
+			return;
+		}
+		std::cout << "GPU culling: " << cullStats.visible / cullStats.frames << " of " << cullStats.total / cullStats.frames
+			<< " draws visible per frame on average over " << cullStats.frames << " frames" << std::endl;
+		if (gpuCulling.occlusion) {
+			std::cout << "Occlusion culling: " << cullStats.late / cullStats.frames << " draws per frame drawn after the depth pyramid test" << std::endl;
+		}
+	}
+
+	// Re-deform if the scene pose changed since the last dispatch, ordered before the following draw submissions
+	void updateComputeDeform()
+	{
+		if (computeDeform.pipeline == VK_NULL_HANDLE || computeDeform.poseVersion == models.scene.poseVersion) {
+			return;
+		}
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &computeDeform.fence, VK_TRUE, UINT64_MAX));
+		VK_CHECK_RESULT(vkResetFences(device, 1, &computeDeform.fence));
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &computeDeform.commandBuffer;
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, computeDeform.fence));
+
+		computeDeform.poseVersion = models.scene.poseVersion;
+	}
+
   void renderCustom(int count, int feature_index) {
       
 	if(!settings.followPath) {
@@ -2222,6 +3676,7 @@ public:
 	do{
 	    res = vkWaitForFences(device, 1, &customStuff.fence, VK_TRUE, 10000000);
 	} while (res == VK_TIMEOUT);
+	readCullStats();
 	
 	VK_CHECK_RESULT(vkResetFences(device, 1, &customStuff.fence));
 
@@ -2258,10 +3713,12 @@ public:
 	
 	tmp += srl.offset / sizeof(out_type);
 
-        out_type* data = new out_type[this->height * this->width * 4];
+	// Owned by the writer jobs once handed off
+	std::shared_ptr<std::vector<out_type> > pixels = std::make_shared<std::vector<out_type> >(this->height * this->width * 4);
+        out_type* data = pixels->data();
 	// Reverse byte order
 	if( srl.rowPitch == this->width * sizeof(out_type) * 4) {
-	    memcpy(data, tmp, srl.size);
+	    memcpy(data, tmp, this->height * srl.rowPitch);
 	} else {
 	    float* dataP = data;
 	    for(uint32_t i = 0; i < this->height; i++) {
@@ -2281,17 +3738,29 @@ public:
 	vkUnmapMemory(device, customStuff.reachableImage.memory);
 	
 	std::ostringstream oss;
-	oss << settings.output_prefixes[feature_index]  << std::setfill('0') << std::setw(OUTPUT_INDEX_PAD) << count << ".exr";
-	std::string filename = oss.str();
+	oss << settings.output_prefixes[feature_index]  << std::setfill('0') << std::setw(OUTPUT_INDEX_PAD) << count;
+	const std::string filename = oss.str() + ".exr";
 
 	// Destructively convert to 3-channel image
 	to3chan(data, this->width, this->height);
-	output_image_float(data, this->width, this->height, 3, filename);
-	
-	delete[] data;
 
-	count++;
-	std::cout << "Image saved to " << filename << std::endl;
+	// Float output and preview encoding run concurrently on the writer threads, sharing the pixels read-only
+	const int w = this->width, h = this->height;
+	writerPool.enqueue([pixels, w, h, filename]() {
+		output_image_float(pixels->data(), w, h, 3, filename);
+		std::cout << "Image saved to " + filename + "\n";
+	    });
+
+	if(!settings.preview_format.empty()) {
+	    const std::string previewFilename = oss.str() + "." + settings.preview_format;
+	    const std::string feature = settings.feature_buffers.size() ? settings.feature_buffers[feature_index] : "";
+	    const std::string mode = preview_mode_for_feature(settings.preview_mode, feature);
+	    const std::string format = settings.preview_format;
+	    const int downscale = settings.preview_downscale, quality = settings.preview_quality;
+	    writerPool.enqueue([pixels, w, h, downscale, mode, format, quality, previewFilename]() {
+		    output_image_preview(pixels->data(), w, h, downscale, mode, format, quality, previewFilename);
+		});
+	}
     }
 
     void destroyCustomStuff() {
@@ -2311,6 +3780,9 @@ public:
 	vkFreeMemory(device, customStuff.fbDepth.memory, nullptr);
 
 	vkDestroyRenderPass(device, customStuff.renderPass, nullptr);
+	if (customStuff.renderPassLoad != VK_NULL_HANDLE) {
+	    vkDestroyRenderPass(device, customStuff.renderPassLoad, nullptr);
+	}
 	
 	vkDestroyFramebuffer(device, customStuff.framebuffer, nullptr);
     }
@@ -2386,6 +3858,15 @@ public:
 	rpci.pDependencies = deps;
 	VK_CHECK_RESULT(vkCreateRenderPass(device, &rpci, nullptr, &customStuff.renderPass));
 
+	if (settings.occlusion_culling) {
+	    for (VkAttachmentDescription &att : atts) {
+		att.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		att.initialLayout = att.finalLayout;
+	    }
+	    atts[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	    VK_CHECK_RESULT(vkCreateRenderPass(device, &rpci, nullptr, &customStuff.renderPassLoad));
+	}
+
 	// Create fence
 	VkFenceCreateInfo fci{};
 	fci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
@@ -2493,14 +3974,20 @@ public:
 	imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
 	imageCI.samples = settings.sampleCount;
 	imageCI.usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	if (settings.occlusion_culling) {
+	    // Read by the depth pyramid between the two occlusion culling phases
+	    imageCI.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	}
 	imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &customStuff.fbDepth.image));
 
 	vkGetImageMemoryRequirements(device, customStuff.fbDepth.image, &memReqs);
 	memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	memAllocInfo.allocationSize = memReqs.size;
-	VkBool32 lazyMemTypePresent;
-	memAllocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, &lazyMemTypePresent);
+	VkBool32 lazyMemTypePresent = VK_FALSE;
+	if (!settings.occlusion_culling) {
+	    memAllocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, &lazyMemTypePresent);
+	}
 	if (!lazyMemTypePresent) {
 	    memAllocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	}
@@ -2758,8 +4245,8 @@ public:
 		}
 
 		// The BMFR counting starts from 1
-		const size_t start_count = settings.interval_t0 == -1 ? 0 : settings.interval_t0;
-		const size_t end_count = settings.interval_t1 == -1 ? settings.pathViews.size() : settings.interval_t1 + 1;
+		const size_t start_count = pathFrameBegin();
+		const size_t end_count = pathFrameEnd();
 				
 		static size_t count = start_count;
 		static size_t feature_count = 0;
@@ -2772,11 +4259,13 @@ public:
 		      feature_count++;
 		      if(feature_count >= settings.feature_buffers.size()) {
 			std::cout << "Done following path, exiting" << std::endl;
+			printCullStats();
 			this->quit = true;
 			return;
 		      }
 		    } else {
 		      std::cout << "Done following path, exiting" << std::endl;
+		      printCullStats();
 		    }
 		      
 		  }
@@ -2784,6 +4273,8 @@ public:
 		  std::pair<glm::vec3, glm::vec3> decomp = settings.pathViews[count];
 		  camera.setRotation(decomp.first);
 		  camera.setPosition(decomp.second);
+		  models.scene.applyPose(static_cast<uint32_t>(count - start_count));
+		  applyPathVisibility(static_cast<uint32_t>(count - start_count));
 		}
 		
 
@@ -2792,6 +4283,7 @@ public:
 		  for(int i = 0; i < num_available_features; i++) {
 		    if(available_features[i] == settings.feature_buffers[feature_count]) {
 		      shaderValuesParams.debugViewEquation = i;
+		      selectFeaturePipelines(i);
 		      ok = true;
 		      break;
 		    }
@@ -2809,7 +4301,15 @@ public:
 		memcpy(currentUB.params.mapped, &shaderValuesParams, sizeof(shaderValuesParams));
 		memcpy(currentUB.skybox.mapped, &shaderValuesSkybox, sizeof(shaderValuesSkybox));
 		
-		
+		updateComputeDeform();
+		updateCullParams();
+		if ((settings.cpu_culling || !pathVisible.empty()) && !useIndirectDraws()) {
+			// The previous frame has finished, so its command buffer can be recorded again with this frame's visible draws
+			if (settings.cpu_culling) {
+				models.scene.cullDraws(vkglTF::Frustum(shaderValuesScene.projection * shaderValuesScene.view * shaderValuesScene.model));
+			}
+			recordCustomCommandBuffer(currentBuffer);
+		}
 		renderCustom(count + settings.start_index, feature_count);
 		count++;
 		